@@ -0,0 +1,377 @@
+/*
+ * Copyright (c) 2023 SINTEF Digital
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Synthetic IMU
+ *
+ * Stands in for the FXAS21002/FXOS8700 pair where there are no sensors,
+ * e.g. on native_sim. A kernel timer at the output data rate advances
+ * the sample index and raises data-ready, sample_fetch() latches the
+ * waveforms at the current index. Values, noise included, only depend
+ * on the index, the channel and the per-instance seed, so two runs
+ * produce the same data however they fetch it.
+ *
+ * Trigger handlers are called from the system work queue, like the
+ * real drivers do from their own thread. The FIFO watermark handler is
+ * the exception, see synth_imu.h.
+ */
+#define DT_DRV_COMPAT avb_synth_imu
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/sys/byteorder.h>
+#include <math.h>
+#include <errno.h>
+
+#include "synth_imu.h"
+
+#define SYNTH_PI	3.14159265358979323846
+#define SYNTH_MAX_ODR	100000
+
+enum synth_ch {
+	SYNTH_GYRO_X, SYNTH_GYRO_Y, SYNTH_GYRO_Z,
+	SYNTH_ACCEL_X, SYNTH_ACCEL_Y, SYNTH_ACCEL_Z,
+	SYNTH_MAGN_X, SYNTH_MAGN_Y, SYNTH_MAGN_Z,
+	SYNTH_TEMP,
+	SYNTH_NUM_CH,
+};
+
+/* Offset and amplitude in micro-units, frequency as a multiple of
+ * signal-mhz and phase in quarter turns. Roughly a device lying flat
+ * and being rocked about all axes.
+ */
+static const struct {
+	int64_t offset;
+	int64_t amplitude;
+	uint8_t mult;
+	uint8_t quarter;
+} synth_wave[SYNTH_NUM_CH] = {
+	[SYNTH_GYRO_X]	= {        0,  500000, 1, 0 },	/* rad/s */
+	[SYNTH_GYRO_Y]	= {        0,  250000, 2, 1 },
+	[SYNTH_GYRO_Z]	= {        0, 1000000, 3, 0 },
+	[SYNTH_ACCEL_X]	= {        0, 1000000, 1, 1 },	/* m/s^2 */
+	[SYNTH_ACCEL_Y]	= {        0, 1000000, 2, 0 },
+	[SYNTH_ACCEL_Z]	= { SENSOR_G,  200000, 5, 0 },
+	[SYNTH_MAGN_X]	= {        0,  400000, 1, 1 },	/* gauss */
+	[SYNTH_MAGN_Y]	= {        0,  400000, 1, 0 },
+	[SYNTH_MAGN_Z]	= {  -300000,   50000, 2, 0 },
+	[SYNTH_TEMP]	= { 25000000,  500000, 1, 0 },	/* degC */
+};
+
+struct synth_imu_config {
+	uint32_t odr_hz;
+	uint32_t signal_mhz;
+	uint32_t noise;
+	uint32_t seed;
+};
+
+struct synth_imu_data {
+	const struct device *dev;
+	struct k_timer timer;
+	struct k_work work;
+	uint32_t odr_hz;
+
+	/* Samples produced so far, advanced by the timer */
+	atomic_t seq;
+
+	/* Latched by sample_fetch(), micro-units */
+	int64_t val[SYNTH_NUM_CH];
+
+	sensor_trigger_handler_t drdy_handler;
+	const struct sensor_trigger *drdy_trig;
+
+	/* FIFO emulation: records are sample indices, evaluated when
+	 * they are read. fifo_seq is the index of the oldest record.
+	 */
+	struct k_spinlock fifo_lock;
+	bool fifo_on;
+	int fifo_first;		/* first of the three channels queued */
+	uint8_t fifo_wm;
+	uint8_t fifo_cnt;
+	bool fifo_ovf;
+	uint32_t fifo_seq;
+
+	sensor_trigger_handler_t wm_handler;
+	const struct sensor_trigger *wm_trig;
+};
+
+/* Queue sample seq, true if it brings the FIFO up to the watermark */
+static bool synth_imu_fifo_push(struct synth_imu_data *data, uint32_t seq)
+{
+	k_spinlock_key_t key = k_spin_lock(&data->fifo_lock);
+	bool wm = false;
+
+	if (data->fifo_on) {
+		if (data->fifo_cnt == SYNTH_IMU_FIFO_SIZE) {
+			/* Circular mode, the oldest record is lost */
+			data->fifo_seq++;
+			data->fifo_ovf = true;
+		} else {
+			if (!data->fifo_cnt)
+				data->fifo_seq = seq;
+			data->fifo_cnt++;
+			wm = data->fifo_cnt == data->fifo_wm;
+		}
+	}
+	k_spin_unlock(&data->fifo_lock, key);
+
+	return wm;
+}
+
+static void synth_imu_timer(struct k_timer *timer)
+{
+	struct synth_imu_data *data = CONTAINER_OF(timer, struct synth_imu_data, timer);
+	uint32_t seq = (uint32_t)atomic_inc(&data->seq) + 1;
+
+	if (synth_imu_fifo_push(data, seq) && data->wm_handler)
+		data->wm_handler(data->dev, data->wm_trig);
+	if (data->drdy_handler)
+		k_work_submit(&data->work);
+}
+
+static void synth_imu_work(struct k_work *work)
+{
+	struct synth_imu_data *data = CONTAINER_OF(work, struct synth_imu_data, work);
+	sensor_trigger_handler_t handler = data->drdy_handler;
+
+	if (handler)
+		handler(data->dev, data->drdy_trig);
+}
+
+static void synth_imu_start(struct synth_imu_data *data)
+{
+	k_timeout_t period = K_NSEC(NSEC_PER_SEC / data->odr_hz);
+
+	k_timer_start(&data->timer, period, period);
+}
+
+/* 32 bit finalizer of MurmurHash3 */
+static inline uint32_t synth_mix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x85ebca6bu;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35u;
+	x ^= x >> 16;
+	return x;
+}
+
+/* Noise of channel c in sample seq. A hash rather than a generator
+ * stepped per call, so it does not depend on how often or in which
+ * order samples are fetched and read from the FIFO.
+ */
+static inline uint32_t synth_noise(uint32_t seed, uint32_t seq, int c)
+{
+	return synth_mix(synth_mix(seed ^ seq) ^ (uint32_t)c);
+}
+
+/* Channels first..first+n-1 of sample seq, micro-units */
+static void synth_imu_eval(const struct device *dev, uint32_t seq, int first, int n, int64_t *val)
+{
+	const struct synth_imu_config *cfg = dev->config;
+	struct synth_imu_data *data = dev->data;
+
+	/* Base phase of this sample, radians */
+	double w = 2.0 * SYNTH_PI * ((double)cfg->signal_mhz / 1000.0) *
+		((double)seq / (double)data->odr_hz);
+
+	for (int c = first; c < first + n; c++) {
+		double x = w * synth_wave[c].mult + synth_wave[c].quarter * (SYNTH_PI / 2);
+		int64_t v = synth_wave[c].offset + (int64_t)(synth_wave[c].amplitude * sin(x));
+
+		if (cfg->noise)
+			v += (int64_t)(synth_noise(cfg->seed, seq, c) % (2 * cfg->noise + 1)) - cfg->noise;
+		val[c - first] = v;
+	}
+}
+
+static int synth_imu_sample_fetch(const struct device *dev, enum sensor_channel chan)
+{
+	struct synth_imu_data *data = dev->data;
+
+	synth_imu_eval(dev, (uint32_t)atomic_get(&data->seq), 0, SYNTH_NUM_CH, data->val);
+	return 0;
+}
+
+int synth_imu_fifo_enable(const struct device *dev, enum sensor_channel chan, uint8_t watermark)
+{
+	struct synth_imu_data *data = dev->data;
+	int first;
+
+	if (chan == SENSOR_CHAN_GYRO_XYZ)
+		first = SYNTH_GYRO_X;
+	else if (chan == SENSOR_CHAN_ACCEL_XYZ)
+		first = SYNTH_ACCEL_X;
+	else
+		return -ENOTSUP;
+	if (!watermark || watermark >= SYNTH_IMU_FIFO_SIZE)
+		return -EINVAL;
+
+	k_spinlock_key_t key = k_spin_lock(&data->fifo_lock);
+
+	data->fifo_first = first;
+	data->fifo_wm = watermark;
+	data->fifo_cnt = 0;
+	data->fifo_ovf = false;
+	data->fifo_on = true;
+	k_spin_unlock(&data->fifo_lock, key);
+	return 0;
+}
+
+int synth_imu_fifo_status(const struct device *dev, uint8_t *status)
+{
+	struct synth_imu_data *data = dev->data;
+	k_spinlock_key_t key = k_spin_lock(&data->fifo_lock);
+
+	*status = (data->fifo_ovf ? SYNTH_IMU_FIFO_OVF : 0) | data->fifo_cnt;
+	data->fifo_ovf = false;
+	k_spin_unlock(&data->fifo_lock, key);
+	return 0;
+}
+
+int synth_imu_fifo_read(const struct device *dev, uint8_t *buf, int n)
+{
+	struct synth_imu_data *data = dev->data;
+	k_spinlock_key_t key = k_spin_lock(&data->fifo_lock);
+	uint32_t seq = data->fifo_seq;
+	int first = data->fifo_first;
+
+	n = MIN(n, data->fifo_cnt);
+	data->fifo_seq += n;
+	data->fifo_cnt -= n;
+	k_spin_unlock(&data->fifo_lock, key);
+
+	/* Evaluated outside the lock, the timer only touches the indices */
+	for (int i = 0; i < n; i++) {
+		int64_t v[3];
+
+		synth_imu_eval(dev, seq + i, first, 3, v);
+		for (int ax = 0; ax < 3; ax++)
+			sys_put_be32((uint32_t)(int32_t)v[ax], &buf[(i * 3 + ax) * 4]);
+	}
+	return n;
+}
+
+static int synth_imu_channel_get(const struct device *dev, enum sensor_channel chan,
+				struct sensor_value *val)
+{
+	struct synth_imu_data *data = dev->data;
+	int first, n = 1;
+
+	switch (chan) {
+	case SENSOR_CHAN_GYRO_X:
+	case SENSOR_CHAN_GYRO_Y:
+	case SENSOR_CHAN_GYRO_Z:
+		first = SYNTH_GYRO_X + (chan - SENSOR_CHAN_GYRO_X);
+		break;
+	case SENSOR_CHAN_GYRO_XYZ:
+		first = SYNTH_GYRO_X;
+		n = 3;
+		break;
+	case SENSOR_CHAN_ACCEL_X:
+	case SENSOR_CHAN_ACCEL_Y:
+	case SENSOR_CHAN_ACCEL_Z:
+		first = SYNTH_ACCEL_X + (chan - SENSOR_CHAN_ACCEL_X);
+		break;
+	case SENSOR_CHAN_ACCEL_XYZ:
+		first = SYNTH_ACCEL_X;
+		n = 3;
+		break;
+	case SENSOR_CHAN_MAGN_X:
+	case SENSOR_CHAN_MAGN_Y:
+	case SENSOR_CHAN_MAGN_Z:
+		first = SYNTH_MAGN_X + (chan - SENSOR_CHAN_MAGN_X);
+		break;
+	case SENSOR_CHAN_MAGN_XYZ:
+		first = SYNTH_MAGN_X;
+		n = 3;
+		break;
+	case SENSOR_CHAN_DIE_TEMP:
+	case SENSOR_CHAN_AMBIENT_TEMP:
+		first = SYNTH_TEMP;
+		break;
+	default:
+		return -ENOTSUP;
+	}
+
+	for (int i = 0; i < n; i++)
+		sensor_value_from_micro(&val[i], data->val[first + i]);
+	return 0;
+}
+
+static int synth_imu_attr_set(const struct device *dev, enum sensor_channel chan,
+			enum sensor_attribute attr, const struct sensor_value *val)
+{
+	struct synth_imu_data *data = dev->data;
+
+	if (attr != SENSOR_ATTR_SAMPLING_FREQUENCY)
+		return -ENOTSUP;
+	if (val->val1 < 1 || val->val1 > SYNTH_MAX_ODR)
+		return -EINVAL;
+
+	k_timer_stop(&data->timer);
+	data->odr_hz = val->val1;
+	atomic_set(&data->seq, 0);
+	synth_imu_start(data);
+	return 0;
+}
+
+static int synth_imu_trigger_set(const struct device *dev, const struct sensor_trigger *trig,
+				sensor_trigger_handler_t handler)
+{
+	struct synth_imu_data *data = dev->data;
+
+	if (trig->type == SENSOR_TRIG_FIFO_WATERMARK) {
+		data->wm_trig = trig;
+		data->wm_handler = handler;
+		return 0;
+	}
+	if (trig->type != SENSOR_TRIG_DATA_READY)
+		return -ENOTSUP;
+
+	data->drdy_trig = trig;
+	data->drdy_handler = handler;
+	return 0;
+}
+
+static const struct sensor_driver_api synth_imu_api = {
+	.sample_fetch = synth_imu_sample_fetch,
+	.channel_get = synth_imu_channel_get,
+	.attr_set = synth_imu_attr_set,
+	.trigger_set = synth_imu_trigger_set,
+};
+
+static int synth_imu_init(const struct device *dev)
+{
+	const struct synth_imu_config *cfg = dev->config;
+	struct synth_imu_data *data = dev->data;
+
+	if (cfg->odr_hz < 1 || cfg->odr_hz > SYNTH_MAX_ODR)
+		return -EINVAL;
+
+	data->dev = dev;
+	data->odr_hz = cfg->odr_hz;
+	atomic_set(&data->seq, 0);
+
+	k_timer_init(&data->timer, synth_imu_timer, NULL);
+	k_work_init(&data->work, synth_imu_work);
+	synth_imu_start(data);
+	return 0;
+}
+
+#define SYNTH_IMU_DEFINE(inst)							\
+	static struct synth_imu_data synth_imu_data_##inst;			\
+	static const struct synth_imu_config synth_imu_config_##inst = {	\
+		.odr_hz = DT_INST_PROP(inst, odr_hz),				\
+		.signal_mhz = DT_INST_PROP(inst, signal_mhz),			\
+		.noise = DT_INST_PROP(inst, noise),				\
+		.seed = 0x9e3779b9u ^ (inst + 1),				\
+	};									\
+	SENSOR_DEVICE_DT_INST_DEFINE(inst, synth_imu_init, NULL,		\
+				&synth_imu_data_##inst, &synth_imu_config_##inst,\
+				POST_KERNEL, CONFIG_SENSOR_INIT_PRIORITY,	\
+				&synth_imu_api);
+
+DT_INST_FOREACH_STATUS_OKAY(SYNTH_IMU_DEFINE)
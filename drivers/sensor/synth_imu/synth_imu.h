@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2023 SINTEF Digital
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Synthetic IMU FIFO emulation
+ *
+ * Stands in for the FXAS21002/FXOS8700 FIFOs so the FIFO burst path
+ * (src/fifo.h) runs on native_sim. Once enabled, every sample produced
+ * by the timer is queued in a circular FIFO of SYNTH_IMU_FIFO_SIZE
+ * records, the oldest one is lost (and the overflow flag set) when it
+ * is full. A record is the three channels of the gyro or the accel as
+ * big-endian int32 micro-units.
+ *
+ * The SENSOR_TRIG_FIFO_WATERMARK handler is called straight from the
+ * timer ISR when the FIFO reaches the watermark, like a GPIO callback
+ * on the interrupt pin of the real parts, so it must be ISR safe.
+ */
+#pragma once
+#include <zephyr/device.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/util.h>
+
+#define SYNTH_IMU_FIFO_SIZE	32
+#define SYNTH_IMU_FIFO_REC_SZ	12
+
+/* Same layout as F_STATUS: overflow flag and record count */
+#define SYNTH_IMU_FIFO_OVF	BIT(7)
+
+/* Queue chan (SENSOR_CHAN_GYRO_XYZ or _ACCEL_XYZ) from the next sample */
+int synth_imu_fifo_enable(const struct device *dev, enum sensor_channel chan, uint8_t watermark);
+
+/* Read the status, clears the overflow flag */
+int synth_imu_fifo_status(const struct device *dev, uint8_t *status);
+
+/* Pop up to n records, oldest first. Returns the number read. */
+int synth_imu_fifo_read(const struct device *dev, uint8_t *buf, int n);
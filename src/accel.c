@@ -1,7 +1,16 @@
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/byteorder.h>
 #include <stdio.h>
 #include "common.h"
+#include "clock.h"
+#include "capture.h"
+#include "latency.h"
+#include "fifo.h"
+#include "acq_rtio.h"
+#ifdef CONFIG_SYNTH_IMU
+#include "synth_imu.h"
+#endif
 
 static struct avb_sensor_data *_data = NULL;
 static const struct device * dev_a = NULL;
@@ -9,14 +18,291 @@ static bool valid = false;
 
 K_SEM_DEFINE(sem_a, 0, 1);	/* starts off "not available" */
 
+/* FIFO burst reads on the real part, or on the FIFO emulation of the
+ * synthetic IMU
+ */
+#ifdef CONFIG_AVB_SENSOR_FIFO
+#if DT_NODE_HAS_COMPAT(AVB_ACCEL_NODE, nxp_fxos8700)
+#define ACCEL_FIFO 1
+#elif DT_NODE_HAS_COMPAT(AVB_ACCEL_NODE, avb_synth_imu)
+#define ACCEL_FIFO 1
+#define ACCEL_FIFO_SYNTH 1
+#endif
+#endif
+
+/* Data-ready interrupt pin, the same one the driver uses */
+#ifdef CONFIG_FXOS8700_DRDY_INT1
+#define ACCEL_INT int1_gpios
+#else
+#define ACCEL_INT int2_gpios
+#endif
+#if DT_NODE_HAS_PROP(AVB_ACCEL_NODE, ACCEL_INT)
+static const struct gpio_dt_spec accel_int = GPIO_DT_SPEC_GET(AVB_ACCEL_NODE, ACCEL_INT);
+#define ACCEL_INT_PIN (&accel_int)
+#else
+#define ACCEL_INT_PIN NULL
+#endif
+
+static struct capture_ts cap_a;
+
+/* Capture time (cycles) of the sample behind sem_a, written by the
+ * trigger while the collector may still be reading the previous one.
+ */
+static atomic_t capture_cyc_a;
+
+/* Time from capture to the collector running, i.e. what used to be
+ * included in the timestamp
+ */
+static inline void capture_delay(uint32_t cyc)
+{
+	latency_add_cyc(LAT_ACCEL_COLLECT, cyc);
+}
+
+#ifdef ACCEL_FIFO
+static struct fifo_burst fifo_a;
+static bool fifo_mode = false;
+#endif
+
+#ifdef ACCEL_FIFO_SYNTH
+#define ACCEL_REC_SZ		SYNTH_IMU_FIFO_REC_SZ
+
+/* Records are micro-units already */
+static inline int64_t accel_fifo_decode(const uint8_t *r, int ax)
+{
+	return (int32_t)sys_get_be32(&r[4 * ax]);
+}
+
+/* Watermark trigger, called from the synthetic IMU's timer ISR */
+static void th_accel_wm(const struct device *dev,
+		const struct sensor_trigger *trigger)
+{
+	capture_ts_edge(&cap_a);
+}
+
+static int accel_fifo_init(void)
+{
+	static const struct sensor_trigger trig = {
+		.type = SENSOR_TRIG_FIFO_WATERMARK,
+		.chan = SENSOR_CHAN_ACCEL_XYZ,
+	};
+	int ret;
+
+	ret = fifo_burst_init_synth(&fifo_a, dev_a, CONFIG_AVB_SENSOR_FIFO_WATERMARK,
+				CONFIG_AVB_ACCEL_ODR_HZ * 1000);
+	if (ret)
+		return ret;
+
+	capture_ts_init_edge(&cap_a);
+	capture_ts_notify(&cap_a, &sem_a);
+	ret = sensor_trigger_set(dev_a, &trig, th_accel_wm);
+	if (!ret)
+		ret = synth_imu_fifo_enable(dev_a, SENSOR_CHAN_ACCEL_XYZ, CONFIG_AVB_SENSOR_FIFO_WATERMARK);
+	if (ret) {
+		capture_ts_notify(&cap_a, NULL);
+		return ret;
+	}
+
+	fifo_mode = true;
+	return 0;
+}
+
+/* Magnetometer and temperature, once per burst */
+static void accel_fifo_magn_temp(struct accel_sample *s)
+{
+	struct sensor_value v[4];
+
+	if (sensor_sample_fetch(dev_a)) {
+		printf("[ACCEL] sensor_sample_fetch() FAILED\n");
+		return;
+	}
+	sensor_channel_get(dev_a, SENSOR_CHAN_MAGN_XYZ, &v[0]);
+	sensor_channel_get(dev_a, SENSOR_CHAN_DIE_TEMP, &v[3]);
+	for (int ax = 0; ax < 3; ax++)
+		s->magn[ax] = sensor_value_to_micro(&v[ax]);
+	s->temp = sensor_value_to_micro(&v[3]);
+}
+#elif defined(ACCEL_FIFO)
+/* FXOS8700 registers, bypassing the driver in FIFO mode. Only the
+ * accelerometer has a FIFO, magnetometer and temperature are read once
+ * per burst and given to all samples in it.
+ */
+#define FXOS_REG_F_STATUS	0x00	/* STATUS while the FIFO is on */
+#define FXOS_REG_OUT_X_MSB	0x01
+#define FXOS_REG_F_SETUP	0x09
+#define FXOS_REG_XYZ_DATA_CFG	0x0e
+#define FXOS_REG_CTRL1		0x2a
+#define FXOS_REG_CTRL4		0x2d
+#define FXOS_REG_CTRL5		0x2e
+#define FXOS_REG_M_OUT_X_MSB	0x33
+#define FXOS_REG_TEMP		0x51
+#define FXOS_REG_M_CTRL1	0x5b
+#define FXOS_REG_M_CTRL2	0x5c
+
+#define FXOS_F_MODE_CIRCULAR	(1 << 6)
+#define FXOS_XYZ_FS_MASK	0x03
+#define FXOS_CTRL1_ACTIVE	BIT(0)
+#define FXOS_CTRL1_DR_SHIFT	3
+#define FXOS_CTRL1_DR_MASK	0x38
+#define FXOS_CTRL4_INT_EN_FIFO	BIT(6)
+#define FXOS_CTRL4_INT_EN_DRDY	BIT(0)
+#define FXOS_CTRL5_INT_CFG_FIFO	BIT(6)	/* route to INT1 */
+#define FXOS_M_CTRL1_HMS_MASK	0x03
+#define FXOS_M_CTRL1_HMS_HYBRID	0x03
+#define FXOS_M_CTRL2_HYB_AUTOINC BIT(5)
+
+#define FXOS_REC_SZ		6
+#define ACCEL_REC_SZ		FXOS_REC_SZ
+
+/* Accel-only ODR, halved in hybrid mode */
+static const uint32_t fxos_odr_mhz[] = {
+	800000, 400000, 200000, 100000, 50000, 12500, 6250, 1563
+};
+
+static const struct i2c_dt_spec accel_i2c = I2C_DT_SPEC_GET(AVB_ACCEL_NODE);
+static bool hybrid;
+
+/* 14 bit left aligned, 4096 LSB/g at 2g, halved for 4g and 8g */
+static int accel_fs;
+
+static inline int64_t fxos_to_um_s2(int16_t raw)
+{
+	return (int64_t)(raw >> 2) * SENSOR_G / (4096 >> accel_fs);
+}
+
+static inline int64_t accel_fifo_decode(const uint8_t *r, int ax)
+{
+	return fxos_to_um_s2((int16_t)sys_get_be16(&r[2 * ax]));
+}
+
+/* Switch the accelerometer to FIFO mode with a watermark interrupt on
+ * the pin the driver uses for data-ready. The driver's DRDY interrupt
+ * is disabled, its trigger is not used at all.
+ */
+static int accel_fifo_init(void)
+{
+	uint8_t xyz_cfg, ctrl1, m_ctrl1;
+	int ret;
+
+	if (!device_is_ready(accel_i2c.bus))
+		return -ENODEV;
+
+	ret = i2c_reg_read_byte_dt(&accel_i2c, FXOS_REG_XYZ_DATA_CFG, &xyz_cfg);
+	if (!ret)
+		ret = i2c_reg_read_byte_dt(&accel_i2c, FXOS_REG_CTRL1, &ctrl1);
+	if (!ret)
+		ret = i2c_reg_read_byte_dt(&accel_i2c, FXOS_REG_M_CTRL1, &m_ctrl1);
+	if (ret)
+		return ret;
+
+	accel_fs = xyz_cfg & FXOS_XYZ_FS_MASK;
+	hybrid = (m_ctrl1 & FXOS_M_CTRL1_HMS_MASK) == FXOS_M_CTRL1_HMS_HYBRID;
+
+	uint32_t odr = fxos_odr_mhz[(ctrl1 & FXOS_CTRL1_DR_MASK) >> FXOS_CTRL1_DR_SHIFT];
+	ret = fifo_burst_init(&fifo_a, &accel_i2c, FXOS_REG_F_STATUS, FXOS_REG_OUT_X_MSB,
+			FXOS_REC_SZ, CONFIG_AVB_SENSOR_FIFO_WATERMARK, hybrid ? odr / 2 : odr);
+	if (ret)
+		return ret;
+
+	capture_ts_notify(&cap_a, &sem_a);
+
+	/* FIFO setup only in standby. Hybrid auto-increment would make
+	 * the burst run on into the magnetometer registers.
+	 */
+	uint8_t int_cfg = IS_ENABLED(CONFIG_FXOS8700_DRDY_INT1) ? FXOS_CTRL5_INT_CFG_FIFO : 0;
+	ret = i2c_reg_write_byte_dt(&accel_i2c, FXOS_REG_CTRL1, ctrl1 & ~FXOS_CTRL1_ACTIVE);
+	if (!ret)
+		ret = i2c_reg_update_byte_dt(&accel_i2c, FXOS_REG_M_CTRL2,
+					FXOS_M_CTRL2_HYB_AUTOINC, 0);
+	if (!ret)
+		ret = i2c_reg_write_byte_dt(&accel_i2c, FXOS_REG_F_SETUP,
+					FXOS_F_MODE_CIRCULAR | CONFIG_AVB_SENSOR_FIFO_WATERMARK);
+	if (!ret)
+		ret = i2c_reg_update_byte_dt(&accel_i2c, FXOS_REG_CTRL5,
+					FXOS_CTRL5_INT_CFG_FIFO, int_cfg);
+	if (!ret)
+		ret = i2c_reg_update_byte_dt(&accel_i2c, FXOS_REG_CTRL4,
+					FXOS_CTRL4_INT_EN_FIFO | FXOS_CTRL4_INT_EN_DRDY,
+					FXOS_CTRL4_INT_EN_FIFO);
+	if (!ret)
+		ret = i2c_reg_write_byte_dt(&accel_i2c, FXOS_REG_CTRL1, ctrl1);
+	if (ret) {
+		capture_ts_notify(&cap_a, NULL);
+		return ret;
+	}
+
+	fifo_mode = true;
+	return 0;
+}
+
+/* Magnetometer and temperature, once per burst */
+static void accel_fifo_magn_temp(struct accel_sample *s)
+{
+	uint8_t m_raw[6] = { 0 };
+	int8_t t_raw = 0;
+
+	/* 0.1 uT (1 mgauss) and 0.96 degC per LSB */
+	if (hybrid && i2c_burst_read_dt(&accel_i2c, FXOS_REG_M_OUT_X_MSB, m_raw, sizeof(m_raw)))
+		printf("[ACCEL] magnetometer read FAILED\n");
+	if (IS_ENABLED(CONFIG_FXOS8700_TEMP) &&
+		i2c_reg_read_byte_dt(&accel_i2c, FXOS_REG_TEMP, (uint8_t *)&t_raw))
+		printf("[ACCEL] temperature read FAILED\n");
+
+	for (int ax = 0; ax < 3; ax++)
+		s->magn[ax] = (int64_t)(int16_t)sys_get_be16(&m_raw[2 * ax]) * 1000;
+	s->temp = (int64_t)t_raw * 960000;
+}
+#endif
+
+#ifdef ACCEL_FIFO
+/* One watermark interrupt (or timeout), one burst */
+static void accel_fifo_collect(void)
+{
+	uint8_t raw[FIFO_MAX_RECORDS * ACCEL_REC_SZ];
+	struct accel_sample s;
+
+	bool irq = k_sem_take(&sem_a, fifo_burst_timeout(&fifo_a)) == 0;
+	uint32_t irq_cyc = capture_ts_take(&cap_a);
+
+	int n = fifo_burst_read(&fifo_a, irq, irq_cyc, raw);
+	if (n < 0) {
+		printf("[ACCEL] FIFO read FAILED (%d)\n", n);
+		return;
+	}
+	if (!n)
+		return;
+	if (irq)
+		capture_delay(irq_cyc);
+
+	accel_fifo_magn_temp(&s);
+
+	for (int i = 0; i < n; i++) {
+		const uint8_t *r = &raw[i * ACCEL_REC_SZ];
+
+		s.ts = clock_cyc32_to_ns(fifo_burst_ts(&fifo_a, i));
+		for (int ax = 0; ax < 3; ax++)
+			s.accel[ax] = accel_fifo_decode(r, ax);
+		data_publish_accel(_data, &s);
+		_data->accel_ctr++;
+	}
+}
+#endif /* ACCEL_FIFO */
+
 static void th_accel(const struct device *dev,
 		const struct sensor_trigger *trigger)
 {
+	uint32_t cyc = capture_ts_take(&cap_a);
+
+#ifdef CONFIG_AVB_RTIO
+	/* Read, decode and publish asynchronously, see acq_rtio.h */
+	acq_rtio_submit(ACQ_ACCEL, cyc);
+#else
 	if (sensor_sample_fetch(dev)) {
 		printf("[ACCEL] sensor_sample_fetch() FAILED\n");
 		return;
 	}
+	atomic_set(&capture_cyc_a, (atomic_val_t)cyc);
 	k_sem_give(&sem_a);
+#endif
 }
 
 
@@ -27,16 +313,19 @@ int accel_init(struct avb_sensor_data *sensor_data)
 
 	_data = sensor_data;
 
-	dev_a = DEVICE_DT_GET_ONE(nxp_fxos8700);
+	dev_a = DEVICE_DT_GET_OR_NULL(AVB_ACCEL_NODE);
+	if (dev_a == NULL) {
+		printf("No accel device in devicetree.\n");
+		return -1;
+	}
 	if (!device_is_ready(dev_a)) {
 		printf("Device %s is not ready\n", dev_a->name);
 		return -1;
 	}
 
-	/* Run sensor at 100Hz (commented out: 6 Hz  */
 	struct sensor_value attr_a = {
-		.val1 = 100, // 6
-		.val2 = 0,   // 250000
+		.val1 = CONFIG_AVB_ACCEL_ODR_HZ,
+		.val2 = 0,
 	};
 
 	if (sensor_attr_set(dev_a, SENSOR_CHAN_ALL,
@@ -45,6 +334,24 @@ int accel_init(struct avb_sensor_data *sensor_data)
 		return -1;
 	}
 
+	if (capture_ts_init(&cap_a, ACCEL_INT_PIN))
+		printf("Could not timestamp %s interrupt, using trigger.\n", dev_a->name);
+
+#ifdef ACCEL_FIFO
+	if (!IS_ENABLED(ACCEL_FIFO_SYNTH) && !cap_a.irq) {
+		printf("No interrupt timestamps for %s, FIFO disabled.\n", dev_a->name);
+	} else if (accel_fifo_init()) {
+		printf("Could not set up FIFO for %s, using trigger.\n", dev_a->name);
+	} else {
+		capture_ts_period(&cap_a, CONFIG_AVB_ACCEL_ODR_HZ, CONFIG_AVB_SENSOR_FIFO_WATERMARK);
+		printf("Device %s is ready, FIFO watermark %d.\n",
+			dev_a->name, CONFIG_AVB_SENSOR_FIFO_WATERMARK);
+		valid = true;
+		return 0;
+	}
+#endif
+
+	capture_ts_period(&cap_a, CONFIG_AVB_ACCEL_ODR_HZ, 1);
 	struct sensor_trigger trig_a = {
 		.type = SENSOR_TRIG_DATA_READY,
 		.chan = SENSOR_CHAN_ACCEL_XYZ,
@@ -68,15 +375,32 @@ void accel_collector(void)
 	} while (!valid);
 
 	while (valid && data_valid(_data)) {
+		struct accel_sample s;
+
+#ifdef ACCEL_FIFO
+		if (fifo_mode) {
+			accel_fifo_collect();
+			continue;
+		}
+#endif
 		k_sem_take(&sem_a, K_FOREVER);
-		uint64_t ts = gptp_ts();
-		if (data_get(_data) == 0) {
-			sensor_channel_get(dev_a, SENSOR_CHAN_ACCEL_XYZ, &_data->accel[0]);
-			sensor_channel_get(dev_a, SENSOR_CHAN_MAGN_XYZ, &_data->magn[0]);
-			sensor_channel_get(dev_a, SENSOR_CHAN_DIE_TEMP, &_data->temp);
-			_data->accel_ts = ts;
-			_data->accel_ctr++;
-			data_put(_data);
+		uint32_t cyc = (uint32_t)atomic_get(&capture_cyc_a);
+
+		s.ts = clock_cyc32_to_ns(cyc);
+		capture_delay(cyc);
+
+		/* Convert here, once, rather than in the Tx path */
+		struct sensor_value v[7];
+
+		sensor_channel_get(dev_a, SENSOR_CHAN_ACCEL_XYZ, &v[0]);
+		sensor_channel_get(dev_a, SENSOR_CHAN_MAGN_XYZ, &v[3]);
+		sensor_channel_get(dev_a, SENSOR_CHAN_DIE_TEMP, &v[6]);
+		for (int i = 0; i < 3; i++) {
+			s.accel[i] = sensor_value_to_micro(&v[i]);
+			s.magn[i]  = sensor_value_to_micro(&v[3 + i]);
 		}
+		s.temp = sensor_value_to_micro(&v[6]);
+		data_publish_accel(_data, &s);
+		_data->accel_ctr++;
 	}
 }
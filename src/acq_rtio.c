@@ -0,0 +1,226 @@
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/rtio/rtio.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "common.h"
+#include "clock.h"
+#include "acq_rtio.h"
+#include "latency.h"
+
+/* Reads in flight per sensor */
+#define ACQ_SLOTS	8
+BUILD_ASSERT(ACQ_SLOTS <= 32, "slot bitmap is a single atomic_t");
+
+/* Room for a generic 3-axis read (header + 3 q31) and then some */
+#define ACQ_BLK_SZ	64
+
+SENSOR_DT_READ_IODEV(gyro_iodev, AVB_GYRO_NODE, {SENSOR_CHAN_GYRO_XYZ, 0});
+SENSOR_DT_READ_IODEV(accel_iodev, AVB_ACCEL_NODE,
+		{SENSOR_CHAN_ACCEL_XYZ, 0},
+		{SENSOR_CHAN_MAGN_XYZ, 0},
+		{SENSOR_CHAN_DIE_TEMP, 0});
+
+RTIO_DEFINE_WITH_MEMPOOL(acq_ctx,
+			ACQ_NUM_SENSORS * ACQ_SLOTS, ACQ_NUM_SENSORS * ACQ_SLOTS,
+			ACQ_NUM_SENSORS * ACQ_SLOTS * 2, ACQ_BLK_SZ, sizeof(void *));
+
+/* Passed as userdata with every read. A slot is taken on submit and
+ * only handed back by the completion, see acq_sensor.busy.
+ */
+struct acq_req {
+	enum acq_sensor_id id;
+	uint32_t capture_cyc;
+};
+
+static struct acq_sensor {
+	struct rtio_iodev *iodev;
+	const struct device *dev;
+	const struct sensor_decoder_api *decoder;
+	struct acq_req req[ACQ_SLOTS];
+	/* Bit per req[] in flight, set by the trigger, cleared by the
+	 * completion thread
+	 */
+	atomic_t busy;
+	uint32_t next;
+	atomic_t dropped;
+} acq[ACQ_NUM_SENSORS] = {
+	[ACQ_GYRO] = {
+		.iodev = &gyro_iodev,
+		.dev = DEVICE_DT_GET(AVB_GYRO_NODE),
+	},
+	[ACQ_ACCEL] = {
+		.iodev = &accel_iodev,
+		.dev = DEVICE_DT_GET(AVB_ACCEL_NODE),
+	},
+};
+
+static struct avb_sensor_data *_data = NULL;
+
+int acq_rtio_init(struct avb_sensor_data *data)
+{
+	if (!data)
+		return -EINVAL;
+
+	for (int i = 0; i < ACQ_NUM_SENSORS; i++) {
+		struct acq_sensor *a = &acq[i];
+
+		if (sensor_get_decoder(a->dev, &a->decoder)) {
+			printf("[RTIO] No decoder for %s\n", a->dev->name);
+			return -ENOTSUP;
+		}
+		a->next = 0;
+		atomic_clear(&a->busy);
+		atomic_set(&a->dropped, 0);
+	}
+
+	_data = data;
+	return 0;
+}
+
+int acq_rtio_submit(enum acq_sensor_id id, uint32_t capture_cyc)
+{
+	struct acq_sensor *a = &acq[id];
+	int slot = -1;
+
+	if (!_data)
+		return -EAGAIN;
+
+	/* Round-robin from the last one, skipping reads still in flight */
+	for (int i = 0; i < ACQ_SLOTS; i++) {
+		int n = (a->next + i) % ACQ_SLOTS;
+
+		if (!atomic_test_and_set_bit(&a->busy, n)) {
+			slot = n;
+			break;
+		}
+	}
+	if (slot < 0) {
+		/* Completion thread ACQ_SLOTS samples behind */
+		atomic_inc(&a->dropped);
+		return -EBUSY;
+	}
+	a->next = slot + 1;
+
+	struct acq_req *req = &a->req[slot];
+
+	req->id = id;
+	req->capture_cyc = capture_cyc;
+
+	int ret = sensor_read_async_mempool(a->iodev, &acq_ctx, req);
+	if (ret) {
+		atomic_clear_bit(&a->busy, slot);
+		atomic_inc(&a->dropped);
+	}
+	return ret;
+}
+
+/* Hand the slot of a completed read back to acq_rtio_submit() */
+static void acq_req_free(const struct acq_req *req)
+{
+	struct acq_sensor *a = &acq[req->id];
+
+	atomic_clear_bit(&a->busy, req - a->req);
+}
+
+/* q31 scaled by 2^shift to micro-units */
+static inline int64_t q31_to_micro(q31_t v, int8_t shift)
+{
+	int64_t m = (int64_t)v * 1000000;
+
+	return shift >= 31 ? m << (shift - 31) : m >> (31 - shift);
+}
+
+static int decode_xyz(const struct acq_sensor *a, const uint8_t *buf,
+		enum sensor_channel chan, int64_t *out)
+{
+	struct sensor_decode_context ctx = SENSOR_DECODE_CONTEXT_INIT(a->decoder, buf, chan, 0);
+	struct sensor_three_axis_data xyz;
+
+	if (sensor_decode(&ctx, &xyz, 1) != 1)
+		return -EIO;
+
+	for (int i = 0; i < 3; i++)
+		out[i] = q31_to_micro(xyz.readings[0].values[i], xyz.shift);
+	return 0;
+}
+
+static void acq_publish(const struct acq_req *req, const uint8_t *buf)
+{
+	const struct acq_sensor *a = &acq[req->id];
+	uint64_t ts = clock_cyc32_to_ns(req->capture_cyc);
+
+	latency_add_cyc(req->id == ACQ_GYRO ? LAT_GYRO_COLLECT : LAT_ACCEL_COLLECT,
+			req->capture_cyc);
+
+	if (req->id == ACQ_GYRO) {
+		struct gyro_sample s = { .ts = ts };
+
+		if (decode_xyz(a, buf, SENSOR_CHAN_GYRO_XYZ, s.gyro)) {
+			printf("[RTIO] gyro decode FAILED\n");
+			return;
+		}
+		data_publish_gyro(_data, &s);
+		_data->gyro_ctr++;
+	} else {
+		struct accel_sample s = { .ts = ts };
+		struct sensor_decode_context ctx =
+			SENSOR_DECODE_CONTEXT_INIT(a->decoder, buf, SENSOR_CHAN_DIE_TEMP, 0);
+		struct sensor_q31_data temp;
+
+		if (decode_xyz(a, buf, SENSOR_CHAN_ACCEL_XYZ, s.accel) ||
+			decode_xyz(a, buf, SENSOR_CHAN_MAGN_XYZ, s.magn)) {
+			printf("[RTIO] accel decode FAILED\n");
+			return;
+		}
+		if (sensor_decode(&ctx, &temp, 1) == 1)
+			s.temp = q31_to_micro(temp.readings[0].temperature, temp.shift);
+		data_publish_accel(_data, &s);
+		_data->accel_ctr++;
+	}
+}
+
+static void acq_complete(struct rtio_cqe *cqe)
+{
+	const struct acq_req *req = cqe->userdata;
+	uint8_t *buf = NULL;
+	uint32_t len = 0;
+
+	/* Buffer must be taken before the CQE is released */
+	int ret = rtio_cqe_get_mempool_buffer(&acq_ctx, cqe, &buf, &len);
+	int res = cqe->result;
+
+	rtio_cqe_release(&acq_ctx, cqe);
+	if (ret) {
+		printf("[RTIO] No buffer in completion (%d)\n", ret);
+		acq_req_free(req);
+		return;
+	}
+
+	if (res < 0)
+		printf("[RTIO] %s read FAILED (%d)\n", acq[req->id].dev->name, res);
+	else
+		acq_publish(req, buf);
+
+	rtio_release_buffer(&acq_ctx, buf, len);
+	acq_req_free(req);
+}
+
+void acq_rtio_process(void)
+{
+	/* Wait for acq_rtio_init() */
+	do {
+		k_sleep(K_SECONDS(1));
+	} while (!_data);
+
+	while (data_valid(_data)) {
+		struct rtio_cqe *cqe = rtio_cqe_consume_block(&acq_ctx);
+
+		/* One wake-up, everything that has completed meanwhile */
+		do {
+			acq_complete(cqe);
+		} while ((cqe = rtio_cqe_consume(&acq_ctx)) != NULL);
+	}
+	printf("[RTIO] Closing down acquisition.\n");
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <zephyr/kernel.h>
+#include "common.h"
+
+/*
+ * Asynchronous sensor acquisition through RTIO
+ *
+ * With CONFIG_AVB_RTIO the data-ready triggers only stamp the capture
+ * time and submit an async read (sensor_read_async_mempool()) instead
+ * of fetching the sample and waking a collector. A single completion
+ * thread, acq_rtio_process(), decodes the finished reads with the
+ * sensor decoder API and publishes them to the sample store, taking
+ * every completion that has queued up per wake-up. This replaces the
+ * two collector threads and their semaphores.
+ */
+enum acq_sensor_id {
+	ACQ_GYRO = 0,
+	ACQ_ACCEL,
+	ACQ_NUM_SENSORS,
+};
+
+/* Call before the sensor triggers are set */
+int acq_rtio_init(struct avb_sensor_data *data);
+
+/* From the trigger handler, capture_cyc is k_cycle_get_32() at
+ * data-ready. Returns 0 or negative errno if the read could not be
+ * queued (counted as dropped), -EBUSY if every slot of the sensor is
+ * still in flight.
+ */
+int acq_rtio_submit(enum acq_sensor_id id, uint32_t capture_cyc);
+
+/* Completion thread */
+void acq_rtio_process(void);
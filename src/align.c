@@ -0,0 +1,135 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+
+#include "align.h"
+
+void align_init(struct align_state *s, unsigned int sensors, uint64_t period_ns)
+{
+	memset(s, 0, sizeof(*s));
+	s->sensors = sensors;
+	s->period_ns = period_ns;
+}
+
+/* First grid point at or after t */
+static uint64_t grid_ceil(const struct align_state *s, uint64_t t)
+{
+	return DIV_ROUND_UP(t, s->period_ns) * s->period_ns;
+}
+
+static bool pull_gyro(struct align_state *s, struct avb_sensor_data *data)
+{
+	struct gyro_sample gs;
+
+	if (data_drain_gyro(data, &gs))
+		return false;
+	s->g[0] = s->g[1];
+	s->g[1] = gs;
+	s->n_g = MIN(s->n_g + 1, 2);
+	return true;
+}
+
+static bool pull_accel(struct align_state *s, struct avb_sensor_data *data)
+{
+	struct accel_sample as;
+
+	if (data_drain_accel(data, &as))
+		return false;
+	s->a[0] = s->a[1];
+	s->a[1] = as;
+	s->n_a = MIN(s->n_a + 1, 2);
+	return true;
+}
+
+/* Start the grid at the first point covered by every sensor */
+static bool align_start(struct align_state *s, struct avb_sensor_data *data)
+{
+	uint64_t first = 0;
+
+	if (s->sensors & AVB_SENSOR_GYRO) {
+		if (!s->n_g && !pull_gyro(s, data))
+			return false;
+		first = MAX(first, s->g[1].ts);
+	}
+	if (s->sensors & AVB_SENSOR_ACCEL) {
+		if (!s->n_a && !pull_accel(s, data))
+			return false;
+		first = MAX(first, s->a[1].ts);
+	}
+	s->next_ns = grid_ceil(s, first);
+	return true;
+}
+
+/* Pull samples until [0] and [1] bracket t */
+static bool bracket(struct align_state *s, struct avb_sensor_data *data, uint64_t t)
+{
+	if (s->sensors & AVB_SENSOR_GYRO) {
+		while (s->n_g < 2 || s->g[1].ts < t)
+			if (!pull_gyro(s, data))
+				return false;
+	}
+	if (s->sensors & AVB_SENSOR_ACCEL) {
+		while (s->n_a < 2 || s->a[1].ts < t)
+			if (!pull_accel(s, data))
+				return false;
+	}
+	return true;
+}
+
+static int64_t lerp(int64_t v0, int64_t v1, uint64_t t0, uint64_t t1, uint64_t t)
+{
+	if (t >= t1 || t1 <= t0)
+		return v1;
+	if (t <= t0)
+		return v0;
+	return v0 + (v1 - v0) * (int64_t)(t - t0) / (int64_t)(t1 - t0);
+}
+
+bool align_next(struct align_state *s, struct avb_sensor_data *data,
+		struct aligned_sample *out)
+{
+	bool g = s->sensors & AVB_SENSOR_GYRO;
+	bool a = s->sensors & AVB_SENSOR_ACCEL;
+
+	if (!s->next_ns && !align_start(s, data))
+		return false;
+
+	/*
+	 * After a gap in one of the sensors (or samples dropped because
+	 * the sender fell behind) the grid point can end up before the
+	 * older sample. Skip ahead rather than fill the gap with held
+	 * values.
+	 */
+	for (;;) {
+		if (!bracket(s, data, s->next_ns))
+			return false;
+
+		uint64_t lo = MAX(g ? s->g[0].ts : 0, a ? s->a[0].ts : 0);
+
+		if (s->next_ns >= lo)
+			break;
+		s->next_ns = grid_ceil(s, lo);
+	}
+
+	uint64_t t = s->next_ns;
+
+	memset(out, 0, sizeof(*out));
+	if (g) {
+		for (int i = 0; i < 3; i++)
+			out->gyro[i] = lerp(s->g[0].gyro[i], s->g[1].gyro[i],
+					s->g[0].ts, s->g[1].ts, t);
+	}
+	if (a) {
+		for (int i = 0; i < 3; i++) {
+			out->accel[i] = lerp(s->a[0].accel[i], s->a[1].accel[i],
+					s->a[0].ts, s->a[1].ts, t);
+			out->magn[i] = lerp(s->a[0].magn[i], s->a[1].magn[i],
+					s->a[0].ts, s->a[1].ts, t);
+		}
+		out->temp = lerp(s->a[0].temp, s->a[1].temp, s->a[0].ts, s->a[1].ts, t);
+	}
+	out->ts = t;
+
+	s->next_ns += s->period_ns;
+	return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "common.h"
+
+/*
+ * Time alignment of gyro and accel/magn/temp samples
+ *
+ * The two sensors run off their own data-ready interrupts, so their
+ * capture times drift against each other and against gPTP. This
+ * resamples both onto a common grid of gPTP time, the multiples of
+ * period_ns, by linear interpolation between the two samples
+ * bracketing each grid point. Grid points are the same on every node
+ * with the same period, as they only depend on gPTP time.
+ *
+ * A grid point is only produced once every sensor has a sample at or
+ * after it, i.e. there is no extrapolation. This holds samples back
+ * by up to one period of the slowest sensor.
+ */
+struct align_state {
+	uint64_t period_ns;
+	uint64_t next_ns;	/* next grid point, 0 until started */
+	unsigned int sensors;	/* enum avb_sensor mask */
+
+	/* Samples bracketing next_ns, [1] is the newer */
+	struct gyro_sample g[2];
+	struct accel_sample a[2];
+	int n_g;
+	int n_a;
+};
+
+/* Co-timed 9-DoF sample plus temperature, micro-units */
+struct aligned_sample {
+	int64_t gyro[3];
+	int64_t accel[3];
+	int64_t magn[3];
+	int64_t temp;
+	uint64_t ts;
+};
+
+void align_init(struct align_state *s, unsigned int sensors, uint64_t period_ns);
+
+/* Produce the next aligned sample from the sample rings, sensors not
+ * in the mask are left 0.
+ *
+ * Returns false if a sensor has not yet delivered a sample at or after
+ * the next grid point. Samples drained so far are kept for the next
+ * call.
+ */
+bool align_next(struct align_state *s, struct avb_sensor_data *data,
+		struct aligned_sample *out);
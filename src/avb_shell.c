@@ -0,0 +1,150 @@
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/net/net_l2.h>
+#include <zephyr/net/ethernet.h>
+#include <zephyr/net/net_mgmt.h>
+#include <zephyr/net/net_stats.h>
+
+#include "common.h"
+#include "latency.h"
+
+/*
+ * "avb" shell command, runtime statistics of the sensor node
+ *
+ *    avb latency         per-stage latency histograms
+ *    avb latency reset   clear them
+ *    avb stats           stream, CBS and interface counters
+ *    avb stats reset     clear the stream counters
+ *
+ * Subcommands are added to the set with SHELL_SUBCMD_ADD(), each
+ * depending on its own Kconfig option.
+ */
+SHELL_SUBCMD_SET_CREATE(avb_cmds, (avb));
+SHELL_CMD_REGISTER(avb, &avb_cmds, "AVB sensor node commands", NULL);
+
+#ifdef CONFIG_AVB_LATENCY_STATS
+static void hist_shell_line(void *ctx, const char *line)
+{
+	shell_print((const struct shell *)ctx, "%s", line);
+}
+
+static int cmd_avb_latency(const struct shell *sh, size_t argc, char **argv)
+{
+	struct hist h;
+
+	for (int st = 0; st < LAT_NUM_STAGES; st++) {
+		latency_get(st, &h);
+		hist_format(&h, latency_name(st), hist_shell_line, (void *)sh);
+	}
+	return 0;
+}
+
+static int cmd_avb_latency_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	latency_reset();
+	shell_print(sh, "Latency histograms cleared");
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(avb_cmd_latency,
+	SHELL_CMD(reset, NULL, "Clear all latency histograms.", cmd_avb_latency_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((avb), latency, &avb_cmd_latency,
+	"Print per-stage latency histograms, data-ready to wire.\n"
+	"Usage: avb latency [reset]", cmd_avb_latency, 1, 0);
+#endif /* CONFIG_AVB_LATENCY_STATS */
+
+#ifdef CONFIG_AVB_STATS
+static const char *sensors_name(unsigned int sensors)
+{
+	return sensors == AVB_SENSOR_ALL ? "all" :
+		sensors == AVB_SENSOR_GYRO ? "gyro" :
+		sensors == AVB_SENSOR_QUAT ? "quat" : "accel";
+}
+
+static void stream_stats_print(const struct shell *sh, int idx, const struct avb_stream_stats *st)
+{
+	/* Per ms, so hours of bits do not overflow */
+	uint64_t elapsed_ms = st->elapsed_ns / NSEC_PER_MSEC;
+	uint64_t bps = elapsed_ms ? st->bits_sent * MSEC_PER_SEC / elapsed_ms : 0;
+	/* Every frame built, sent or not, was granted credit first */
+	uint32_t grants = st->frames_sent + st->send_failed + st->skipped_empty + st->skipped_nobufs;
+	uint32_t waited = grants ? (uint32_t)(st->credit_wait_ns / grants) : 0;
+
+	shell_print(sh, "Stream %d (%s, class %s), %"PRIu64" ms", idx, sensors_name(st->sensors),
+		st->sc == CLASS_A ? "A" : st->sc == CLASS_B ? "B" : "none", elapsed_ms);
+	shell_print(sh, "  frames sent         = %10u", st->frames_sent);
+	shell_print(sh, "  send failed         = %10u", st->send_failed);
+	shell_print(sh, "  skipped, no data    = %10u", st->skipped_empty);
+	shell_print(sh, "  skipped, no buffer  = %10u", st->skipped_nobufs);
+	shell_print(sh, "  TAS gate missed     = %10u", st->gate_missed);
+	shell_print(sh, "  ring dropped        = %10u samples", st->ring_dropped);
+	shell_print(sh, "  credit min/max      = %10d / %d bits (lo %d, hi %d)",
+		st->credit_min, st->credit_max, st->lo_credit, st->hi_credit);
+	shell_print(sh, "  credit underflows   = %10u", st->credit_underflows);
+	shell_print(sh, "  credit wait avg/max = %10u / %u ns", waited, st->credit_wait_max_ns);
+	shell_print(sh, "  bandwidth           = %10"PRIu64" bps of %"PRId64" bps idleSlope (%u%%)",
+		bps, st->idle_slope,
+		st->idle_slope > 0 ? (unsigned int)(bps * 100 / st->idle_slope) : 0);
+}
+
+#ifdef CONFIG_NET_STATISTICS_USER_API
+/* What the stack saw on the AVB interface, all traffic incl. gPTP */
+static void iface_stats_print(const struct shell *sh)
+{
+	struct net_if *iface = net_if_get_first_by_type(&NET_L2_GET_NAME(ETHERNET));
+	struct net_stats ns;
+
+	if (!iface)
+		return;
+
+	if (net_mgmt(NET_REQUEST_STATS_GET_ALL, iface, &ns, sizeof(ns)) == 0) {
+		shell_print(sh, "Interface %d", net_if_get_by_iface(iface));
+		shell_print(sh, "  bytes sent          = %10"PRIu64, (uint64_t)ns.bytes.sent);
+		shell_print(sh, "  bytes received      = %10"PRIu64, (uint64_t)ns.bytes.received);
+		shell_print(sh, "  processing errors   = %10"PRIu64, (uint64_t)ns.processing_error);
+	}
+#ifdef CONFIG_NET_STATISTICS_ETHERNET
+	struct net_stats_eth es;
+
+	/* Only if the driver keeps them */
+	if (net_mgmt(NET_REQUEST_STATS_GET_ETHERNET, iface, &es, sizeof(es)) == 0) {
+		shell_print(sh, "  eth frames sent     = %10"PRIu64, (uint64_t)es.pkts.tx);
+		shell_print(sh, "  eth Tx dropped      = %10"PRIu64, (uint64_t)es.tx_dropped);
+		shell_print(sh, "  eth Tx timeouts     = %10"PRIu64, (uint64_t)es.tx_timeout_count);
+	}
+#endif
+}
+#endif
+
+static int cmd_avb_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct avb_stream_stats st;
+
+	for (int idx = 0; network_stream_stats(idx, &st) == 0; idx++)
+		stream_stats_print(sh, idx, &st);
+#ifdef CONFIG_NET_STATISTICS_USER_API
+	iface_stats_print(sh);
+#endif
+	return 0;
+}
+
+static int cmd_avb_stats_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	network_stats_reset();
+	shell_print(sh, "Stream counters cleared");
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(avb_cmd_stats,
+	SHELL_CMD(reset, NULL, "Clear the stream counters.", cmd_avb_stats_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((avb), stats, &avb_cmd_stats,
+	"Print frame, CBS and bandwidth counters per stream.\n"
+	"Usage: avb stats [reset]", cmd_avb_stats, 1, 0);
+#endif /* CONFIG_AVB_STATS */
@@ -32,11 +32,11 @@
 #include "avtp.h"
 #include "util.h"
 
-#define SHIFT_SUBTYPE			(31 - 7)
-#define SHIFT_VERSION			(31 - 11)
+#define SHIFT_SUBTYPE			AVTP_SHIFT_SUBTYPE
+#define SHIFT_VERSION			AVTP_SHIFT_VERSION
 
-#define MASK_SUBTYPE			(BITMASK(8) << SHIFT_SUBTYPE)
-#define MASK_VERSION			(BITMASK(3) << SHIFT_VERSION)
+#define MASK_SUBTYPE			AVTP_MASK(SUBTYPE)
+#define MASK_VERSION			AVTP_MASK(VERSION)
 
 int avtp_pdu_get(const struct avtp_common_pdu *pdu, enum avtp_field field,
 								uint32_t *val)
@@ -29,6 +29,7 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <zephyr/net/net_ip.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -85,6 +86,37 @@ enum avtp_field {
 	AVTP_FIELD_MAX,
 };
 
+/* Bit layout of the common AVTPDU header word (host order) */
+#define AVTP_SHIFT_SUBTYPE			(31 - 7)
+#define AVTP_SHIFT_VERSION			(31 - 11)
+
+#define AVTP_WIDTH_SUBTYPE			8
+#define AVTP_WIDTH_VERSION			3
+
+#define AVTP_MASK(field) \
+	(((1UL << AVTP_WIDTH_##field) - 1) << AVTP_SHIFT_##field)
+
+/* Statically specialised accessors for the common header fields, same
+ * semantics as avtp_pdu_get()/_set() with a compile-time field.
+ *
+ *    uint32_t avtp_get_<field>(const struct avtp_common_pdu *pdu);
+ *    void avtp_set_<field>(struct avtp_common_pdu *pdu, uint32_t val);
+ */
+#define AVTP_COMMON_ACCESSORS(name, FIELD)					\
+static inline uint32_t avtp_get_##name(const struct avtp_common_pdu *pdu)	\
+{										\
+	return (ntohl(pdu->subtype_data) & AVTP_MASK(FIELD)) >>		\
+		AVTP_SHIFT_##FIELD;						\
+}										\
+static inline void avtp_set_##name(struct avtp_common_pdu *pdu, uint32_t val)	\
+{										\
+	pdu->subtype_data = htonl((ntohl(pdu->subtype_data) & ~AVTP_MASK(FIELD)) | \
+				((val << AVTP_SHIFT_##FIELD) & AVTP_MASK(FIELD))); \
+}
+
+AVTP_COMMON_ACCESSORS(subtype, SUBTYPE)
+AVTP_COMMON_ACCESSORS(version, VERSION)
+
 /* Get value from Common AVTPDU field.
  * @pdu: Pointer to PDU struct.
  * @field: PDU field to be retrieved.
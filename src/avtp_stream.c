@@ -34,18 +34,18 @@
 #include "avtp_stream.h"
 #include "util.h"
 
-#define SHIFT_SV			(31 - 8)
-#define SHIFT_MR			(31 - 12)
-#define SHIFT_TV			(31 - 15)
-#define SHIFT_SEQ_NUM			(31 - 23)
-#define SHIFT_STREAM_DATA_LEN		(31 - 15)
-
-#define MASK_SV				(BITMASK(1) << SHIFT_SV)
-#define MASK_MR				(BITMASK(1) << SHIFT_MR)
-#define MASK_TV				(BITMASK(1) << SHIFT_TV)
-#define MASK_SEQ_NUM			(BITMASK(8) << SHIFT_SEQ_NUM)
-#define MASK_TU				(BITMASK(1))
-#define MASK_STREAM_DATA_LEN		(BITMASK(16) << SHIFT_STREAM_DATA_LEN)
+#define SHIFT_SV			AVTP_STREAM_SHIFT_SV
+#define SHIFT_MR			AVTP_STREAM_SHIFT_MR
+#define SHIFT_TV			AVTP_STREAM_SHIFT_TV
+#define SHIFT_SEQ_NUM			AVTP_STREAM_SHIFT_SEQ_NUM
+#define SHIFT_STREAM_DATA_LEN		AVTP_STREAM_SHIFT_STREAM_DATA_LEN
+
+#define MASK_SV				AVTP_STREAM_MASK(SV)
+#define MASK_MR				AVTP_STREAM_MASK(MR)
+#define MASK_TV				AVTP_STREAM_MASK(TV)
+#define MASK_SEQ_NUM			AVTP_STREAM_MASK(SEQ_NUM)
+#define MASK_TU				AVTP_STREAM_MASK(TU)
+#define MASK_STREAM_DATA_LEN		AVTP_STREAM_MASK(STREAM_DATA_LEN)
 
 static int get_field_value(const struct avtp_stream_pdu *pdu,
 				enum avtp_stream_field field, uint64_t *val)
@@ -114,6 +114,10 @@ int avtp_stream_pdu_get(const struct avtp_stream_pdu *pdu,
 		*val = ntohl(pdu->avtp_time);
 		res = 0;
 		break;
+	case AVTP_STREAM_FIELD_FORMAT_SPECIFIC:
+		*val = ntohl(pdu->format_specific);
+		res = 0;
+		break;
 	case AVTP_STREAM_FIELD_STREAM_ID:
 		*val = sys_be64_to_cpu(pdu->stream_id);
 		res = 0;
@@ -197,6 +201,10 @@ int avtp_stream_pdu_set(struct avtp_stream_pdu *pdu,
 		pdu->avtp_time = htonl(value);
 		res = 0;
 		break;
+	case AVTP_STREAM_FIELD_FORMAT_SPECIFIC:
+		pdu->format_specific = htonl(value);
+		res = 0;
+		break;
 	case AVTP_STREAM_FIELD_STREAM_ID:
 		pdu->stream_id = sys_cpu_to_be64(value);
 		res = 0;
@@ -227,3 +235,21 @@ int avtp_stream_pdu_init(struct avtp_stream_pdu *pdu)
 
 	return 0;
 }
+
+int avtp_stream_tmpl_init(struct avtp_stream_tmpl *tmpl,
+				const struct avtp_stream_pdu *pdu)
+{
+	if (!tmpl || !pdu)
+		return -EINVAL;
+
+	tmpl->pdu = *pdu;
+
+	tmpl->subtype_data = ntohl(pdu->subtype_data) & ~(MASK_SEQ_NUM | MASK_TV);
+	tmpl->packet_info = ntohl(pdu->packet_info) & ~MASK_STREAM_DATA_LEN;
+
+	tmpl->pdu.subtype_data = htonl(tmpl->subtype_data);
+	tmpl->pdu.avtp_time = 0;
+	tmpl->pdu.packet_info = htonl(tmpl->packet_info);
+
+	return 0;
+}
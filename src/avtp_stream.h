@@ -28,7 +28,12 @@
 #pragma once
 
 #include <errno.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <zephyr/net/net_ip.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "avtp.h"
 
 #pragma GCC visibility push(hidden)
 
@@ -66,9 +71,92 @@ enum avtp_stream_field {
 	AVTP_STREAM_FIELD_STREAM_ID,
 	AVTP_STREAM_FIELD_TIMESTAMP,
 	AVTP_STREAM_FIELD_STREAM_DATA_LEN,
+	AVTP_STREAM_FIELD_FORMAT_SPECIFIC,
 	AVTP_STREAM_FIELD_MAX
 };
 
+/* Bit layout of the Stream AVTPDU header words (host order, after
+ * ntohl()). TU is bit 0 of subtype_data.
+ */
+#define AVTP_STREAM_SHIFT_SV			(31 - 8)
+#define AVTP_STREAM_SHIFT_MR			(31 - 12)
+#define AVTP_STREAM_SHIFT_TV			(31 - 15)
+#define AVTP_STREAM_SHIFT_SEQ_NUM		(31 - 23)
+#define AVTP_STREAM_SHIFT_TU			0
+#define AVTP_STREAM_SHIFT_STREAM_DATA_LEN	(31 - 15)
+
+#define AVTP_STREAM_WIDTH_SV			1
+#define AVTP_STREAM_WIDTH_MR			1
+#define AVTP_STREAM_WIDTH_TV			1
+#define AVTP_STREAM_WIDTH_SEQ_NUM		8
+#define AVTP_STREAM_WIDTH_TU			1
+#define AVTP_STREAM_WIDTH_STREAM_DATA_LEN	16
+
+#define AVTP_STREAM_MASK(field) \
+	(((1UL << AVTP_STREAM_WIDTH_##field) - 1) << AVTP_STREAM_SHIFT_##field)
+
+/* Statically specialised field accessors
+ *
+ * Same semantics as avtp_stream_pdu_get()/_set() for a field known at
+ * compile time, but without the runtime field switch and argument
+ * checks: each reduces to a byte swap and a constant shift/mask.
+ *
+ *    uint32_t avtp_stream_get_<field>(const struct avtp_stream_pdu *pdu);
+ *    void avtp_stream_set_<field>(struct avtp_stream_pdu *pdu, uint32_t val);
+ *
+ * for sv, mr, tv, seq_num, tu and stream_data_len, plus the full-word
+ * stream_id, timestamp and format_specific accessors below.
+ */
+#define AVTP_STREAM_BITFIELD_ACCESSORS(name, FIELD, word)			\
+static inline uint32_t avtp_stream_get_##name(const struct avtp_stream_pdu *pdu) \
+{										\
+	return (ntohl(pdu->word) & AVTP_STREAM_MASK(FIELD)) >>			\
+		AVTP_STREAM_SHIFT_##FIELD;					\
+}										\
+static inline void avtp_stream_set_##name(struct avtp_stream_pdu *pdu,	\
+					uint32_t val)				\
+{										\
+	pdu->word = htonl((ntohl(pdu->word) & ~AVTP_STREAM_MASK(FIELD)) |	\
+			((val << AVTP_STREAM_SHIFT_##FIELD) & AVTP_STREAM_MASK(FIELD))); \
+}
+
+AVTP_STREAM_BITFIELD_ACCESSORS(sv, SV, subtype_data)
+AVTP_STREAM_BITFIELD_ACCESSORS(mr, MR, subtype_data)
+AVTP_STREAM_BITFIELD_ACCESSORS(tv, TV, subtype_data)
+AVTP_STREAM_BITFIELD_ACCESSORS(seq_num, SEQ_NUM, subtype_data)
+AVTP_STREAM_BITFIELD_ACCESSORS(tu, TU, subtype_data)
+AVTP_STREAM_BITFIELD_ACCESSORS(stream_data_len, STREAM_DATA_LEN, packet_info)
+
+static inline uint64_t avtp_stream_get_stream_id(const struct avtp_stream_pdu *pdu)
+{
+	return sys_be64_to_cpu(pdu->stream_id);
+}
+
+static inline void avtp_stream_set_stream_id(struct avtp_stream_pdu *pdu, uint64_t val)
+{
+	pdu->stream_id = sys_cpu_to_be64(val);
+}
+
+static inline uint32_t avtp_stream_get_timestamp(const struct avtp_stream_pdu *pdu)
+{
+	return ntohl(pdu->avtp_time);
+}
+
+static inline void avtp_stream_set_timestamp(struct avtp_stream_pdu *pdu, uint32_t val)
+{
+	pdu->avtp_time = htonl(val);
+}
+
+static inline uint32_t avtp_stream_get_format_specific(const struct avtp_stream_pdu *pdu)
+{
+	return ntohl(pdu->format_specific);
+}
+
+static inline void avtp_stream_set_format_specific(struct avtp_stream_pdu *pdu, uint32_t val)
+{
+	pdu->format_specific = htonl(val);
+}
+
 /* Get value from Stream AVTPDU field.
  * @pdu: Pointer to PDU struct.
  * @field: PDU field to be retrieved.
@@ -95,6 +183,54 @@ int avtp_stream_pdu_set(struct avtp_stream_pdu *pdu,
 
 int avtp_stream_pdu_init(struct avtp_stream_pdu *pdu);
 
+/* Stream header template
+ *
+ * Every field but seq_num, tv, avtp_timestamp and stream_data_len is
+ * constant for the lifetime of a stream. The template holds the header
+ * fully encoded in network order, plus host order copies of the two
+ * words that change per frame with the changing bits cleared, so the
+ * per-frame update is a handful of direct big-endian stores rather than
+ * a read-modify-write through avtp_stream_pdu_set() per field.
+ */
+struct avtp_stream_tmpl {
+	struct avtp_stream_pdu pdu;
+	uint32_t subtype_data;
+	uint32_t packet_info;
+};
+
+/* Initialize template from a PDU header set up with the regular
+ * setters (stream_id, format_specific, ...).
+ *
+ * Returns:
+ *    0: Success.
+ *    -EINVAL: If any argument is invalid.
+ */
+int avtp_stream_tmpl_init(struct avtp_stream_tmpl *tmpl,
+				const struct avtp_stream_pdu *pdu);
+
+/* Write the complete template header into pdu, e.g. into a freshly
+ * allocated Tx buffer.
+ */
+static inline void avtp_stream_tmpl_copy(const struct avtp_stream_tmpl *tmpl,
+					struct avtp_stream_pdu *pdu)
+{
+	*pdu = tmpl->pdu;
+}
+
+/* Per-frame update of a PDU holding the template header. */
+static inline void avtp_stream_tmpl_update(const struct avtp_stream_tmpl *tmpl,
+					struct avtp_stream_pdu *pdu,
+					uint8_t seq_num, bool tv,
+					uint32_t avtp_time, uint16_t data_len)
+{
+	pdu->subtype_data = htonl(tmpl->subtype_data |
+				((uint32_t)seq_num << AVTP_STREAM_SHIFT_SEQ_NUM) |
+				(tv ? AVTP_STREAM_MASK(TV) : 0));
+	pdu->avtp_time = htonl(avtp_time);
+	pdu->packet_info = htonl(tmpl->packet_info |
+				((uint32_t)data_len << AVTP_STREAM_SHIFT_STREAM_DATA_LEN));
+}
+
 #ifdef __cplusplus
 }
 #endif
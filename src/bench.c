@@ -0,0 +1,487 @@
+#include <zephyr/kernel.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "common.h"
+#include "codec.h"
+#include "avtp.h"
+#include "avtp_stream.h"
+#include "clock.h"
+#include "decim.h"
+#include "fusion.h"
+#include "payload.h"
+
+/*
+ * Startup micro-benchmarks
+ *
+ * Run once from main() before the sensors and network are brought up,
+ * so the numbers are not disturbed by the rest of the system. Timing
+ * uses the kernel cycle counter.
+ */
+
+#define BENCH_ROUNDS	100
+
+/* Deterministic pseudo-random noise, same sequence on every target */
+static uint32_t lcg_state = 1;
+static int16_t noise(int amplitude)
+{
+	lcg_state = lcg_state * 1664525u + 1013904223u;
+	return (int16_t)((int32_t)(lcg_state >> 16) % (2 * amplitude + 1) - amplitude);
+}
+
+#ifdef CONFIG_AVB_BENCH_CODEC
+#define CODEC_N		CONFIG_AVB_BENCH_CODEC_SAMPLES
+#define CODEC_CH	7
+
+static uint32_t codec_ts[CODEC_N];
+static int16_t codec_val[CODEC_N][CODEC_CH];
+static uint32_t codec_ts_out[CODEC_N];
+static int16_t codec_val_out[CODEC_N][CODEC_CH];
+static uint8_t codec_buf[CODEC_N * (4 + 2 * CODEC_CH) + 64];
+
+static void bench_codec(void)
+{
+	uint32_t enc_cyc = UINT32_MAX;
+	uint32_t dec_cyc = UINT32_MAX;
+	int enc_sz = 0;
+
+	/* IMU-like input: slow triangle wave per channel plus a few LSB
+	 * of noise, sampled at 1 kHz with a little timestamp jitter.
+	 */
+	for (int i = 0; i < CODEC_N; i++) {
+		codec_ts[i] = i * 1000000 + noise(500);
+		for (int c = 0; c < CODEC_CH; c++) {
+			int phase = (i * (c + 1) * 64) % 4096;
+			int tri = phase < 2048 ? phase : 4096 - phase;
+
+			codec_val[i][c] = (int16_t)(tri - 1024 + 1000 * c + noise(8));
+		}
+	}
+
+	/* Keep the best of several rounds, which is what the code costs
+	 * when not interrupted.
+	 */
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		uint32_t t0 = k_cycle_get_32();
+
+		enc_sz = codec_encode_block(codec_buf, sizeof(codec_buf), codec_ts,
+					&codec_val[0][0], CODEC_CH, CODEC_N);
+		uint32_t t1 = k_cycle_get_32();
+
+		codec_decode_block(codec_buf, enc_sz, codec_ts_out,
+				&codec_val_out[0][0], CODEC_CH, CODEC_N);
+		uint32_t t2 = k_cycle_get_32();
+
+		enc_cyc = MIN(enc_cyc, t1 - t0);
+		dec_cyc = MIN(dec_cyc, t2 - t1);
+	}
+
+	bool ok = enc_sz > 0 &&
+		!memcmp(codec_ts, codec_ts_out, sizeof(codec_ts)) &&
+		!memcmp(codec_val, codec_val_out, sizeof(codec_val));
+	int raw_sz = CODEC_N * (sizeof(uint32_t) + CODEC_CH * sizeof(int16_t));
+
+	printf("[BENCH] codec: %d samples x %d ch, %d -> %d bytes (%d.%02dx), round-trip %s\n",
+		CODEC_N, CODEC_CH, raw_sz, enc_sz,
+		raw_sz / MAX(enc_sz, 1), (raw_sz * 100 / MAX(enc_sz, 1)) % 100,
+		ok ? "OK" : "FAILED");
+	printf("[BENCH] codec: encode %u cycles (%u/sample, %u ns), decode %u cycles (%u/sample, %u ns)\n",
+		enc_cyc, enc_cyc / CODEC_N, k_cyc_to_ns_floor32(enc_cyc),
+		dec_cyc, dec_cyc / CODEC_N, k_cyc_to_ns_floor32(dec_cyc));
+}
+#endif /* CONFIG_AVB_BENCH_CODEC */
+
+#ifdef CONFIG_AVB_BENCH_AVTP_HDR
+#define HDR_ITER	1000
+
+static uint8_t hdr_buf[sizeof(struct avtp_stream_pdu)] __aligned(4);
+
+/* Per-frame header update as done by network_sender() before header
+ * templates: four setter calls for id, length, seq_num and tv + time.
+ */
+static uint32_t hdr_setters(struct avtp_stream_pdu *pdu)
+{
+	uint32_t t0 = k_cycle_get_32();
+
+	for (int i = 0; i < HDR_ITER; i++) {
+		avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_STREAM_ID, 0x0011223344550042ULL);
+		avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_STREAM_DATA_LEN, 104);
+		avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_SEQ_NUM, i & 0xff);
+		avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_TV, 1);
+		avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_TIMESTAMP, i * 10000);
+		compiler_barrier();
+	}
+	return k_cycle_get_32() - t0;
+}
+
+static uint32_t hdr_tmpl(const struct avtp_stream_tmpl *tmpl,
+			struct avtp_stream_pdu *pdu, bool copy)
+{
+	uint32_t t0 = k_cycle_get_32();
+
+	for (int i = 0; i < HDR_ITER; i++) {
+		if (copy)
+			avtp_stream_tmpl_copy(tmpl, pdu);
+		avtp_stream_tmpl_update(tmpl, pdu, i & 0xff, true, i * 10000, 104);
+		compiler_barrier();
+	}
+	return k_cycle_get_32() - t0;
+}
+
+static void bench_avtp_hdr(void)
+{
+	struct avtp_stream_pdu *pdu = (struct avtp_stream_pdu *)hdr_buf;
+	struct avtp_stream_tmpl tmpl;
+	uint32_t set_cyc = UINT32_MAX;
+	uint32_t upd_cyc = UINT32_MAX;
+	uint32_t cpy_cyc = UINT32_MAX;
+
+	avtp_stream_pdu_init(pdu);
+	avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_STREAM_ID, 0x0011223344550042ULL);
+	avtp_stream_tmpl_init(&tmpl, pdu);
+
+	for (int r = 0; r < BENCH_ROUNDS / 10; r++) {
+		set_cyc = MIN(set_cyc, hdr_setters(pdu));
+		upd_cyc = MIN(upd_cyc, hdr_tmpl(&tmpl, pdu, false));
+		cpy_cyc = MIN(cpy_cyc, hdr_tmpl(&tmpl, pdu, true));
+	}
+
+	printf("[BENCH] avtp hdr: setters %u ns/frame, template update %u ns/frame, template copy+update %u ns/frame\n",
+		k_cyc_to_ns_floor32(set_cyc) / HDR_ITER,
+		k_cyc_to_ns_floor32(upd_cyc) / HDR_ITER,
+		k_cyc_to_ns_floor32(cpy_cyc) / HDR_ITER);
+}
+#endif /* CONFIG_AVB_BENCH_AVTP_HDR */
+
+#ifdef CONFIG_AVB_BENCH_AVTP_FIELDS
+#define FIELD_ITER	1000
+
+static volatile uint64_t field_sink;
+
+static void field_report(const char *name, uint32_t gen_set, uint32_t gen_get,
+			uint32_t fast_set, uint32_t fast_get)
+{
+	printf("[BENCH] %-16s %8u %8u %8u %8u\n", name,
+		k_cyc_to_ns_floor32(gen_set) / FIELD_ITER,
+		k_cyc_to_ns_floor32(fast_set) / FIELD_ITER,
+		k_cyc_to_ns_floor32(gen_get) / FIELD_ITER,
+		k_cyc_to_ns_floor32(fast_get) / FIELD_ITER);
+}
+
+/* Time encode and decode of one field through the generic
+ * get/set (runtime field switch) and the specialised inline accessor.
+ */
+#define FIELD_BENCH(name, pdu, gen_set_call, gen_get_call, fast_set_call, fast_get_call) \
+	do {									\
+		uint32_t t0, gen_set, gen_get, fast_set, fast_get;		\
+		uint64_t acc = 0, v;						\
+										\
+		t0 = k_cycle_get_32();						\
+		for (uint32_t i = 0; i < FIELD_ITER; i++) {			\
+			gen_set_call;						\
+			compiler_barrier();					\
+		}								\
+		gen_set = k_cycle_get_32() - t0;				\
+										\
+		t0 = k_cycle_get_32();						\
+		for (uint32_t i = 0; i < FIELD_ITER; i++) {			\
+			gen_get_call;						\
+			acc += v;						\
+			compiler_barrier();					\
+		}								\
+		gen_get = k_cycle_get_32() - t0;				\
+										\
+		t0 = k_cycle_get_32();						\
+		for (uint32_t i = 0; i < FIELD_ITER; i++) {			\
+			fast_set_call;						\
+			compiler_barrier();					\
+		}								\
+		fast_set = k_cycle_get_32() - t0;				\
+										\
+		t0 = k_cycle_get_32();						\
+		for (uint32_t i = 0; i < FIELD_ITER; i++) {			\
+			v = fast_get_call;					\
+			acc += v;						\
+			compiler_barrier();					\
+		}								\
+		fast_get = k_cycle_get_32() - t0;				\
+										\
+		field_sink += acc;						\
+		field_report(name, gen_set, gen_get, fast_set, fast_get);	\
+	} while (0)
+
+#define STREAM_FIELD_BENCH(name, FIELD)						\
+	FIELD_BENCH(#name, pdu,							\
+		avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_##FIELD, i),		\
+		avtp_stream_pdu_get(pdu, AVTP_STREAM_FIELD_##FIELD, &v),	\
+		avtp_stream_set_##name(pdu, i),					\
+		avtp_stream_get_##name(pdu))
+
+#define COMMON_FIELD_BENCH(name, FIELD)						\
+	FIELD_BENCH(#name, pdu,							\
+		avtp_pdu_set(cpdu, AVTP_FIELD_##FIELD, i),			\
+		({ uint32_t __v; avtp_pdu_get(cpdu, AVTP_FIELD_##FIELD, &__v); v = __v; }), \
+		avtp_set_##name(cpdu, i),					\
+		avtp_get_##name(cpdu))
+
+static uint8_t field_buf[sizeof(struct avtp_stream_pdu)] __aligned(4);
+
+static void bench_avtp_fields(void)
+{
+	struct avtp_stream_pdu *pdu = (struct avtp_stream_pdu *)field_buf;
+	struct avtp_common_pdu *cpdu = (struct avtp_common_pdu *)field_buf;
+
+	avtp_stream_pdu_init(pdu);
+
+	printf("[BENCH] AVTP field accessors, ns/op\n");
+	printf("[BENCH] %-16s %8s %8s %8s %8s\n", "field",
+		"set", "set(inl)", "get", "get(inl)");
+
+	COMMON_FIELD_BENCH(subtype, SUBTYPE);
+	COMMON_FIELD_BENCH(version, VERSION);
+	STREAM_FIELD_BENCH(sv, SV);
+	STREAM_FIELD_BENCH(mr, MR);
+	STREAM_FIELD_BENCH(tv, TV);
+	STREAM_FIELD_BENCH(seq_num, SEQ_NUM);
+	STREAM_FIELD_BENCH(tu, TU);
+	STREAM_FIELD_BENCH(stream_id, STREAM_ID);
+	STREAM_FIELD_BENCH(timestamp, TIMESTAMP);
+	STREAM_FIELD_BENCH(stream_data_len, STREAM_DATA_LEN);
+	STREAM_FIELD_BENCH(format_specific, FORMAT_SPECIFIC);
+}
+#endif /* CONFIG_AVB_BENCH_AVTP_FIELDS */
+
+#ifdef CONFIG_AVB_BENCH_SAMPLE_CONV
+/* What the Tx path did per frame before samples were stored in
+ * micro-units: ten sensor_value_to_micro() for a gyro and an accel
+ * sample, versus the plain copy it does now. The conversion moved to
+ * the collectors, once per sample.
+ */
+static struct sensor_value conv_in[10];
+static struct gyro_sample conv_gs;
+static struct accel_sample conv_as;
+static struct sensor_set conv_out;
+
+static uint32_t conv_old(void)
+{
+	uint32_t t0 = k_cycle_get_32();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		for (int i = 0; i < 3; i++) {
+			conv_out.gyro[i]  = sensor_value_to_micro(&conv_in[i]);
+			conv_out.accel[i] = sensor_value_to_micro(&conv_in[3 + i]);
+			conv_out.magn[i]  = sensor_value_to_micro(&conv_in[6 + i]);
+		}
+		conv_out.temp = sensor_value_to_micro(&conv_in[9]);
+		compiler_barrier();
+	}
+	return k_cycle_get_32() - t0;
+}
+
+static uint32_t conv_new(void)
+{
+	uint32_t t0 = k_cycle_get_32();
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		memcpy(conv_out.gyro, conv_gs.gyro, sizeof(conv_out.gyro));
+		memcpy(conv_out.accel, conv_as.accel, sizeof(conv_out.accel));
+		memcpy(conv_out.magn, conv_as.magn, sizeof(conv_out.magn));
+		conv_out.temp = conv_as.temp;
+		compiler_barrier();
+	}
+	return k_cycle_get_32() - t0;
+}
+
+static void bench_sample_conv(void)
+{
+	for (int i = 0; i < ARRAY_SIZE(conv_in); i++) {
+		conv_in[i].val1 = noise(20);
+		conv_in[i].val2 = noise(30000) * 33;
+	}
+	for (int i = 0; i < 3; i++) {
+		conv_gs.gyro[i]  = sensor_value_to_micro(&conv_in[i]);
+		conv_as.accel[i] = sensor_value_to_micro(&conv_in[3 + i]);
+		conv_as.magn[i]  = sensor_value_to_micro(&conv_in[6 + i]);
+	}
+	conv_as.temp = sensor_value_to_micro(&conv_in[9]);
+
+	uint32_t c_old = conv_old();
+	uint32_t c_new = conv_new();
+
+	printf("[BENCH] sample conv: sensor_value_to_micro() %u ns/frame, copy %u ns/frame\n",
+		k_cyc_to_ns_floor32(c_old / BENCH_ROUNDS),
+		k_cyc_to_ns_floor32(c_new / BENCH_ROUNDS));
+}
+#endif /* CONFIG_AVB_BENCH_SAMPLE_CONV */
+
+#ifdef CONFIG_AVB_BENCH_CLOCK
+#define CLOCK_ITER	1000
+#define CLOCK_SAMPLES	100
+
+void bench_clock(void)
+{
+	uint32_t t0 = k_cycle_get_32();
+	for (int i = 0; i < CLOCK_ITER; i++)
+		(void)gptp_ts();
+	uint32_t t1 = k_cycle_get_32();
+	for (int i = 0; i < CLOCK_ITER; i++)
+		(void)now_ns();
+	uint32_t t2 = k_cycle_get_32();
+
+	printf("[BENCH] clock: gptp_ts() %u ns/call, now_ns() %u ns/call\n",
+		k_cyc_to_ns_floor32((t1 - t0) / CLOCK_ITER),
+		k_cyc_to_ns_floor32((t2 - t1) / CLOCK_ITER));
+
+	/* Compare against gPTP bracketed by two now_ns(), spread out
+	 * over a couple of update periods so the error includes the
+	 * rate error accumulated between updates.
+	 */
+	int64_t err_max = 0;
+	int64_t err_sum = 0;
+
+	for (int i = 0; i < CLOCK_SAMPLES; i++) {
+		uint64_t a = now_ns();
+		uint64_t g = gptp_ts();
+		uint64_t b = now_ns();
+		int64_t err = (int64_t)(g - (a + (b - a) / 2));
+
+		err = err < 0 ? -err : err;
+		err_max = MAX(err_max, err);
+		err_sum += err;
+		k_sleep(K_USEC(CONFIG_AVB_CLOCK_UPDATE_MS * 1000 * 2 / CLOCK_SAMPLES + 7));
+	}
+	printf("[BENCH] clock: now_ns() vs gptp_ts() over %d samples: avg |err| %"PRId64" ns, max %"PRId64" ns (%s)\n",
+		CLOCK_SAMPLES, err_sum / CLOCK_SAMPLES, err_max,
+		clock_sync_state() == CLOCK_LOCKED ? "locked" :
+		clock_sync_state() == CLOCK_HOLDOVER ? "holdover" : "unsynced");
+}
+#endif /* CONFIG_AVB_BENCH_CLOCK */
+
+#ifdef CONFIG_AVB_BENCH_DECIMATE
+/* Highest ODR supported by both FXAS21002 and FXOS8700 */
+#define DECIM_BENCH_ODR	800
+#define DECIM_BENCH_N	ROUND_UP(64, DECIM_FACTOR)
+
+static struct gyro_sample decim_gs[DECIM_BENCH_N];
+static struct accel_sample decim_as[DECIM_BENCH_N];
+
+static void bench_decimate(void)
+{
+	struct gyro_sample gout;
+	struct accel_sample aout;
+	uint32_t best = UINT32_MAX;
+	int outputs = 0;
+
+	/* Slow sines well inside the pass band, plus noise */
+	for (int i = 0; i < DECIM_BENCH_N; i++) {
+		int64_t s = (int64_t)(1000000 * sin(2 * M_PI * i / DECIM_BENCH_N));
+
+		decim_gs[i].ts = decim_as[i].ts = (uint64_t)i * NSEC_PER_SEC / DECIM_BENCH_ODR;
+		for (int c = 0; c < 3; c++) {
+			decim_gs[i].gyro[c] = s * (c + 1) + noise(2000);
+			decim_as[i].accel[c] = s / (c + 1) + noise(2000);
+			decim_as[i].magn[c] = s / 4 + noise(1000);
+		}
+		decim_as[i].temp = 25000000 + noise(1000);
+	}
+
+	for (int r = 0; r < BENCH_ROUNDS / 10; r++) {
+		decim_init();
+
+		/* Settle, so the one-off priming is not counted */
+		decim_gyro(&decim_gs[0], &gout);
+		decim_accel(&decim_as[0], &aout);
+
+		outputs = 0;
+		uint32_t t0 = k_cycle_get_32();
+
+		for (int i = 0; i < DECIM_BENCH_N; i++) {
+			outputs += decim_gyro(&decim_gs[i], &gout);
+			outputs += decim_accel(&decim_as[i], &aout);
+		}
+		best = MIN(best, k_cycle_get_32() - t0);
+	}
+
+	/* Gyro + accel sample, i.e. all ten channels, every ODR period */
+	uint32_t per_sample = best / DECIM_BENCH_N;
+	uint64_t per_sec = (uint64_t)per_sample * DECIM_BENCH_ODR;
+	uint32_t load = (uint32_t)(per_sec * 10000 / sys_clock_hw_cycles_per_sec());
+
+	printf("[BENCH] decimate: %d taps, /%d, %s, %d outputs, %u cycles (%u ns) per gyro+accel sample, %u/channel\n",
+		DECIM_TAPS, DECIM_FACTOR,
+		IS_ENABLED(CONFIG_AVB_DECIMATE_Q31) ? "q31" : "q15", outputs,
+		per_sample, k_cyc_to_ns_floor32(per_sample), per_sample / 10);
+	printf("[BENCH] decimate: both sensors at %d Hz: %u.%02u%% CPU, %u of %u ns per sample period\n",
+		DECIM_BENCH_ODR, load / 100, load % 100,
+		k_cyc_to_ns_floor32(per_sample), (uint32_t)(NSEC_PER_SEC / DECIM_BENCH_ODR));
+}
+#endif /* CONFIG_AVB_BENCH_DECIMATE */
+
+#ifdef CONFIG_AVB_BENCH_FUSION
+#define FUSION_N		256
+#define FUSION_BENCH_ODR	800
+
+static struct gyro_sample fusion_gs[FUSION_N];
+static struct accel_sample fusion_as;
+
+static void bench_fusion(void)
+{
+	struct quat_sample qs;
+	uint32_t best = UINT32_MAX;
+
+	/* Slow rotation about all axes, device lying flat in a field
+	 * pointing north and down.
+	 */
+	for (int i = 0; i < FUSION_N; i++) {
+		fusion_gs[i].ts = (uint64_t)i * NSEC_PER_SEC / FUSION_BENCH_ODR;
+		for (int c = 0; c < 3; c++)
+			fusion_gs[i].gyro[c] = 100000 * (c + 1) + noise(5000);
+	}
+	fusion_as.accel[2] = 9806650;
+	fusion_as.magn[0] = 200000;
+	fusion_as.magn[2] = 450000;
+
+	for (int r = 0; r < BENCH_ROUNDS / 10; r++) {
+		fusion_init();
+
+		uint32_t t0 = k_cycle_get_32();
+
+		for (int i = 0; i < FUSION_N; i++)
+			fusion_update(&fusion_gs[i], &fusion_as, &qs);
+		best = MIN(best, k_cycle_get_32() - t0);
+	}
+
+	uint32_t per_update = best / FUSION_N;
+	uint32_t load = (uint32_t)((uint64_t)per_update * FUSION_BENCH_ODR * 10000 /
+				sys_clock_hw_cycles_per_sec());
+
+	printf("[BENCH] fusion: %u cycles (%u ns) per update, %u.%02u%% CPU at %d Hz, q = [%d %d %d %d]\n",
+		per_update, k_cyc_to_ns_floor32(per_update), load / 100, load % 100,
+		FUSION_BENCH_ODR, qs.q[0], qs.q[1], qs.q[2], qs.q[3]);
+	printf("[BENCH] fusion: %u bytes per orientation sample, %u per raw sensor_set\n",
+		(uint32_t)sizeof(struct quat_set), (uint32_t)sizeof(struct sensor_set));
+}
+#endif /* CONFIG_AVB_BENCH_FUSION */
+
+void bench_run(void)
+{
+#ifdef CONFIG_AVB_BENCH_CODEC
+	bench_codec();
+#endif
+#ifdef CONFIG_AVB_BENCH_AVTP_HDR
+	bench_avtp_hdr();
+#endif
+#ifdef CONFIG_AVB_BENCH_AVTP_FIELDS
+	bench_avtp_fields();
+#endif
+#ifdef CONFIG_AVB_BENCH_SAMPLE_CONV
+	bench_sample_conv();
+#endif
+#ifdef CONFIG_AVB_BENCH_DECIMATE
+	bench_decimate();
+#endif
+#ifdef CONFIG_AVB_BENCH_FUSION
+	bench_fusion();
+#endif
+}
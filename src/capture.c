@@ -0,0 +1,81 @@
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "capture.h"
+
+void capture_ts_edge(struct capture_ts *c)
+{
+	atomic_set(&c->irq_cyc, (atomic_val_t)k_cycle_get_32());
+	if (c->notify)
+		k_sem_give(c->notify);
+}
+
+static void capture_isr(const struct device *port, struct gpio_callback *cb,
+			gpio_port_pins_t pins)
+{
+	capture_ts_edge(CONTAINER_OF(cb, struct capture_ts, cb));
+}
+
+void capture_ts_init_edge(struct capture_ts *c)
+{
+	c->pin = NULL;
+	c->notify = NULL;
+	atomic_set(&c->irq_cyc, 0);
+	c->max_age_cyc = sys_clock_hw_cycles_per_sec();
+	c->irq = true;
+}
+
+void capture_ts_period(struct capture_ts *c, uint32_t odr_hz, uint32_t n)
+{
+	if (odr_hz)
+		c->max_age_cyc = (uint64_t)sys_clock_hw_cycles_per_sec() * MAX(n, 1) / odr_hz;
+}
+
+int capture_ts_init(struct capture_ts *c, const struct gpio_dt_spec *pin)
+{
+	if (!c)
+		return -EINVAL;
+
+	c->pin = pin;
+	c->irq = false;
+	c->notify = NULL;
+	atomic_set(&c->irq_cyc, 0);
+	c->max_age_cyc = sys_clock_hw_cycles_per_sec();
+
+	if (!IS_ENABLED(CONFIG_AVB_IRQ_TIMESTAMP) || !pin || !pin->port)
+		return 0;
+
+	if (!device_is_ready(pin->port)) {
+		printf("[CAPTURE] GPIO %s not ready, timestamping in trigger\n", pin->port->name);
+		return 0;
+	}
+
+	/* The driver owns the pin and its interrupt configuration, we
+	 * only add a second callback for the same edge.
+	 */
+	gpio_init_callback(&c->cb, capture_isr, BIT(pin->pin));
+	int ret = gpio_add_callback(pin->port, &c->cb);
+	if (ret < 0) {
+		printf("[CAPTURE] Failed adding callback on %s.%u (%d)\n",
+			pin->port->name, pin->pin, ret);
+		return ret;
+	}
+	c->irq = true;
+	return 0;
+}
+
+uint32_t capture_ts_take(struct capture_ts *c)
+{
+	uint32_t now = k_cycle_get_32();
+
+	if (!c->irq)
+		return now;
+
+	/* An edge older than one period belongs to an earlier sample */
+	uint32_t irq = (uint32_t)atomic_get(&c->irq_cyc);
+	if (now - irq > c->max_age_cyc)
+		return now;
+	return irq;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/sys/atomic.h>
+
+/*
+ * Data-ready timestamping
+ *
+ * The sensor drivers handle the data-ready interrupt in their own
+ * thread and only then call our trigger handler, followed by an I2C
+ * transfer and a wake-up of the collector. To get the capture time
+ * without all that latency, an extra GPIO callback is added on the
+ * sensor's interrupt pin which records the cycle counter straight from
+ * the ISR.
+ *
+ * If the pin is not available (not in DT, CONFIG_AVB_IRQ_TIMESTAMP=n),
+ * the cycle counter is read at the start of the trigger handler
+ * instead, which still excludes the I2C transfer and collector
+ * scheduling.
+ */
+struct capture_ts {
+	struct gpio_callback cb;
+	const struct gpio_dt_spec *pin;
+
+	/* k_cycle_get_32() at the last data-ready edge */
+	atomic_t irq_cyc;
+	bool irq;
+
+	/* Edges older than this when taken were missed */
+	uint32_t max_age_cyc;
+
+	/* Given from the ISR if set, see capture_ts_notify() */
+	struct k_sem *notify;
+};
+
+/* pin may be NULL, falls back to trigger handler timestamps */
+int capture_ts_init(struct capture_ts *c, const struct gpio_dt_spec *pin);
+
+/* For an interrupt not seen through a GPIO callback, e.g. a trigger
+ * called from the interrupt itself (synth_imu.h). Edges are then
+ * reported with capture_ts_edge().
+ */
+void capture_ts_init_edge(struct capture_ts *c);
+
+/* Expect an edge every n samples at odr_hz. capture_ts_take() falls
+ * back to the current time if the last edge is older than that, i.e.
+ * the one for this sample was missed. Defaults to 1 s after init.
+ */
+void capture_ts_period(struct capture_ts *c, uint32_t odr_hz, uint32_t n);
+
+/* Record an edge now, from the ISR */
+void capture_ts_edge(struct capture_ts *c);
+
+/* Wake a thread directly from the ISR on every edge, for when nothing
+ * is done in the sensor trigger (e.g. FIFO mode, fifo.h). Only valid
+ * if capture_ts_init() set up the callback (c->irq).
+ */
+static inline void capture_ts_notify(struct capture_ts *c, struct k_sem *sem)
+{
+	c->notify = sem;
+}
+
+/* Call first thing in the trigger handler, returns the capture time as
+ * k_cycle_get_32() cycles.
+ */
+uint32_t capture_ts_take(struct capture_ts *c);
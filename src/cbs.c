@@ -0,0 +1,156 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <errno.h>
+
+#include "cbs.h"
+
+static inline uint64_t cbs_cycles(struct cbs *cbs)
+{
+#ifdef CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER
+	return k_cycle_get_64();
+#else
+	/* Extend the 32 bit counter; we are called far more often than
+	 * it wraps and elapsed time is capped in cbs_update() anyway.
+	 */
+	uint32_t now = k_cycle_get_32();
+	return cbs->last_cyc + (uint32_t)(now - (uint32_t)cbs->last_cyc);
+#endif
+}
+
+/* Bring credit up to date, caller must hold the lock */
+static void cbs_update(struct cbs *cbs)
+{
+	uint64_t now = cbs_cycles(cbs);
+	uint64_t elapsed = now - cbs->last_cyc;
+	int64_t hi = (int64_t)cbs->hi_credit * cbs->cyc_per_sec;
+
+	cbs->last_cyc = now;
+
+	if (cbs->credit >= 0 && cbs->queue == 0) {
+		/* no waiters, release excess credits */
+		cbs->credit = 0;
+		return;
+	}
+
+	/* Never more than what takes us from the bottom to hiCredit,
+	 * this also keeps the product below from overflowing.
+	 */
+	uint64_t max_elapsed = (hi - cbs->credit) / cbs->idle_slope + 1;
+	if (elapsed > max_elapsed)
+		elapsed = max_elapsed;
+
+	cbs->credit += (int64_t)elapsed * cbs->idle_slope;
+
+	if (cbs->queue == 0 && cbs->credit > 0)
+		cbs->credit = 0;
+	else if (cbs->credit > hi)
+		cbs->credit = hi;
+}
+
+int cbs_init(struct cbs *cbs, int64_t idle_slope, int hi_credit, int lo_credit)
+{
+	if (!cbs || idle_slope <= 0)
+		return -EINVAL;
+
+	k_mutex_init(&cbs->lock);
+	cbs->idle_slope = idle_slope;
+	cbs->hi_credit = hi_credit;
+	cbs->lo_credit = lo_credit;
+	cbs->credit = 0;
+	cbs->queue = 0;
+	cbs->credit_min = 0;
+	cbs->credit_max = 0;
+	cbs->underflows = 0;
+	cbs->cyc_per_sec = sys_clock_hw_cycles_per_sec();
+#ifdef CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER
+	cbs->last_cyc = k_cycle_get_64();
+#else
+	cbs->last_cyc = k_cycle_get_32();
+#endif
+	return 0;
+}
+
+/* Cycles until credit crosses 0 (rounded up), 0 if we can send now */
+static uint64_t cbs_wait_cycles(struct cbs *cbs)
+{
+	if (cbs->credit >= 0)
+		return 0;
+	return (-cbs->credit + cbs->idle_slope - 1) / cbs->idle_slope;
+}
+
+uint64_t cbs_credit_poll(struct cbs *cbs)
+{
+	uint64_t wait;
+
+	k_mutex_lock(&cbs->lock, K_FOREVER);
+	cbs_update(cbs);
+	if (cbs->queue == 0)
+		cbs->queue = 1;
+	wait = cbs_wait_cycles(cbs);
+	k_mutex_unlock(&cbs->lock);
+
+	return wait;
+}
+
+void cbs_credit_cancel(struct cbs *cbs)
+{
+	k_mutex_lock(&cbs->lock, K_FOREVER);
+	cbs_update(cbs);
+	if (cbs->queue > 0)
+		cbs->queue--;
+	k_mutex_unlock(&cbs->lock);
+}
+
+int cbs_credit_put(struct cbs *cbs, int tx_bits)
+{
+	if (k_mutex_lock(&cbs->lock, K_FOREVER) != 0)
+		return -EBUSY;
+
+	/* Update with the frame still queued, credit accumulated while
+	 * waiting to send is not released.
+	 */
+	cbs_update(cbs);
+	if (cbs->queue > 0)
+		cbs->queue--;
+
+	cbs->credit_max = MAX(cbs->credit_max, cbs->credit);
+	cbs->credit -= (int64_t)tx_bits * cbs->cyc_per_sec;
+	cbs->credit_min = MIN(cbs->credit_min, cbs->credit);
+
+	/* A frame larger than maxFrameSize, loCredit is too small */
+	if (cbs->credit < (int64_t)cbs->lo_credit * cbs->cyc_per_sec)
+		cbs->underflows++;
+
+	k_mutex_unlock(&cbs->lock);
+	return 0;
+}
+
+int cbs_credit(struct cbs *cbs)
+{
+	int64_t credit;
+
+	k_mutex_lock(&cbs->lock, K_FOREVER);
+	cbs_update(cbs);
+	credit = cbs->credit;
+	k_mutex_unlock(&cbs->lock);
+
+	return (int)(credit / cbs->cyc_per_sec);
+}
+
+void cbs_stats(struct cbs *cbs, int *min, int *max, uint32_t *underflows)
+{
+	k_mutex_lock(&cbs->lock, K_FOREVER);
+	*min = (int)(cbs->credit_min / cbs->cyc_per_sec);
+	*max = (int)(cbs->credit_max / cbs->cyc_per_sec);
+	*underflows = cbs->underflows;
+	k_mutex_unlock(&cbs->lock);
+}
+
+void cbs_stats_reset(struct cbs *cbs)
+{
+	k_mutex_lock(&cbs->lock, K_FOREVER);
+	cbs->credit_min = 0;
+	cbs->credit_max = 0;
+	cbs->underflows = 0;
+	k_mutex_unlock(&cbs->lock);
+}
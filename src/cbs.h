@@ -0,0 +1,70 @@
+#pragma once
+#include <zephyr/kernel.h>
+
+/* Software credit based shaper (802.1Qav) without a refill thread.
+ *
+ * Credit is not replenished periodically, instead it is brought up to
+ * date whenever it is looked at, from the number of cycles elapsed
+ * since the last update. Internally credit is kept in bits scaled by
+ * the cycle rate (bit-cycles/sec), so idleSlope * elapsed_cycles adds
+ * up exactly and no fraction of a bit is ever lost.
+ *
+ * The rules are the same as the old refill task:
+ * - credit < 0: replenish at idleSlope, regardless of queue
+ * - credit >= 0 and a frame is queued: replenish, capped at hiCredit
+ * - credit >= 0 and nothing queued: credit is reset to 0
+ */
+struct cbs {
+	struct k_mutex lock;
+
+	/* bits/sec */
+	int64_t idle_slope;
+
+	/* Credit limits, bits */
+	int hi_credit;
+	int lo_credit;
+
+	/* Credit, bits * cycles/sec */
+	int64_t credit;
+	uint32_t cyc_per_sec;
+	uint64_t last_cyc;
+
+	/* Frames waiting for credit (or being sent) */
+	int queue;
+
+	/* Credit range seen when charging frames, bits * cycles/sec,
+	 * and how often it went below loCredit. See cbs_stats().
+	 */
+	int64_t credit_min;
+	int64_t credit_max;
+	uint32_t underflows;
+};
+
+int cbs_init(struct cbs *cbs, int64_t idle_slope, int hi_credit, int lo_credit);
+
+/* Reserve the right to send one frame, never blocks so a single
+ * thread can serve several shapers.
+ *
+ * Marks a frame as pending (if not already) and returns 0 if it may be
+ * sent now, otherwise the number of cycles until credit crosses 0. A
+ * frame that is sent must be charged with cbs_credit_put(), otherwise
+ * released with cbs_credit_cancel().
+ */
+uint64_t cbs_credit_poll(struct cbs *cbs);
+
+/* Release a reservation not used for transmission. */
+void cbs_credit_cancel(struct cbs *cbs);
+
+/* Charge a sent frame (tx_bits, everything on the wire incl. L1) */
+int cbs_credit_put(struct cbs *cbs, int tx_bits);
+
+/* Current credit in bits, brought up to date */
+int cbs_credit(struct cbs *cbs);
+
+/* Lowest (after) and highest (before) credit when charging a frame
+ * since cbs_init() or cbs_stats_reset(), in bits, and the number of
+ * frames that took credit below loCredit. Both are 0 before the first
+ * frame.
+ */
+void cbs_stats(struct cbs *cbs, int *min, int *max, uint32_t *underflows);
+void cbs_stats_reset(struct cbs *cbs);
@@ -0,0 +1,194 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+#include <stdio.h>
+
+#include "common.h"
+#include "clock.h"
+
+/* Reject rate samples further than this from nominal, e.g. when the
+ * gPTP stack steps its clock on a grandmaster change.
+ */
+#define RATE_MAX_PPM		1000
+
+/* Weight of a new rate sample, 1/2^RATE_FILTER_SHIFT */
+#define RATE_FILTER_SHIFT	3
+
+/* Max rate reduction while catching up with gPTP time that is behind
+ * what now_ns() has already returned, see clock_service().
+ */
+#define SLEW_MAX_PPM		500
+
+/*
+ * ns = base_ns + (cycles - base_cyc) * mult / 2^32
+ *
+ * mult is ns per cycle in Q32. The mapping is re-based on every update,
+ * so (cycles - base_cyc) stays well below 2^32 and the 64 bit products
+ * in map_apply() do not overflow.
+ */
+struct clock_map {
+	uint64_t base_cyc;
+	uint64_t base_ns;
+	uint64_t mult;
+};
+
+/* Published through a sequence latch, single writer (clock_service()) */
+static atomic_t map_seq;
+static struct clock_map map_latch[2];
+static atomic_t sync_state = ATOMIC_INIT(CLOCK_UNSYNCED);
+
+static inline uint64_t clock_cycles(void)
+{
+#ifdef CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER
+	return k_cycle_get_64();
+#else
+	return k_cycle_get_32();
+#endif
+}
+
+static inline uint64_t cyc_delta(uint64_t from, uint64_t to)
+{
+#ifdef CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER
+	return to - from;
+#else
+	/* 32 bit counter, wraps far less often than we re-base */
+	return (uint32_t)((uint32_t)to - (uint32_t)from);
+#endif
+}
+
+static inline uint64_t cyc_scale(uint64_t d, uint64_t mult)
+{
+	return d * (mult >> 32) + ((d * (mult & 0xffffffff)) >> 32);
+}
+
+static inline uint64_t map_apply(const struct clock_map *m, uint64_t cyc)
+{
+	return m->base_ns + cyc_scale(cyc_delta(m->base_cyc, cyc), m->mult);
+}
+
+uint64_t now_ns(void)
+{
+	struct clock_map m;
+
+	latch_read(&map_seq, map_latch, &m, sizeof(m));
+	if (!m.mult)
+		return gptp_ts();
+	return map_apply(&m, clock_cycles());
+}
+
+uint64_t clock_cyc32_to_ns(uint32_t cyc)
+{
+	struct clock_map m;
+
+	latch_read(&map_seq, map_latch, &m, sizeof(m));
+	if (!m.mult)
+		return gptp_ts() - k_cyc_to_ns_floor64(k_cycle_get_32() - cyc);
+
+	/* The mapping may have been re-based after cyc was taken */
+	int32_t d = (int32_t)(cyc - (uint32_t)m.base_cyc);
+	if (d >= 0)
+		return m.base_ns + cyc_scale(d, m.mult);
+	return m.base_ns - cyc_scale(-(int64_t)d, m.mult);
+}
+
+enum clock_sync clock_sync_state(void)
+{
+	return (enum clock_sync)atomic_get(&sync_state);
+}
+
+void clock_service(void)
+{
+	const uint64_t nominal = (NSEC_PER_SEC << 32) / sys_clock_hw_cycles_per_sec();
+	const uint64_t max_dev = nominal / (1000000 / RATE_MAX_PPM);
+	const uint64_t max_slew = nominal / (1000000 / SLEW_MAX_PPM);
+	const uint64_t period_cyc = (uint64_t)sys_clock_hw_cycles_per_sec() *
+		CONFIG_AVB_CLOCK_UPDATE_MS / MSEC_PER_SEC;
+	struct clock_map m = {0};
+	uint64_t rate = 0;
+	enum clock_sync state = CLOCK_UNSYNCED;
+	uint64_t last_cyc = 0;
+	uint64_t last_ns = 0;
+	int64_t holdover_start = 0;
+	int updates = 0;
+
+	/* Give gptp_init() a chance to run */
+	k_sleep(K_MSEC(100));
+
+	while (1) {
+		bool gm_present;
+
+		/* Pair gPTP time with the middle of the capture */
+		uint64_t c0 = clock_cycles();
+		uint64_t ptp = gptp_ts_gm(&gm_present);
+		uint64_t c1 = clock_cycles();
+		uint64_t cyc = c0 + cyc_delta(c0, c1) / 2;
+
+		if (gm_present || state == CLOCK_UNSYNCED) {
+			if (!rate)
+				rate = nominal;
+
+			uint64_t dc = cyc_delta(last_cyc, cyc);
+			if (last_ns && dc && ptp > last_ns) {
+				uint64_t r = ((ptp - last_ns) << 32) / dc;
+
+				if (r + max_dev > nominal && r < nominal + max_dev)
+					rate += ((int64_t)(r - rate)) >> RATE_FILTER_SHIFT;
+			}
+
+			/* Step the offset forward, the rate keeps the error
+			 * between updates small. Never step back: if gPTP
+			 * time is behind what now_ns() already returned,
+			 * keep counting from there at a reduced rate until
+			 * caught up, over one update period at most
+			 * SLEW_MAX_PPM allows.
+			 */
+			uint64_t at = m.mult ? map_apply(&m, cyc) : 0;
+
+			m.base_cyc = cyc;
+			m.mult = rate;
+			if (ptp >= at) {
+				m.base_ns = ptp;
+			} else {
+				uint64_t behind = MIN(at - ptp, NSEC_PER_SEC);
+
+				m.base_ns = at;
+				m.mult -= MIN((behind << 32) / period_cyc, max_slew);
+			}
+			last_cyc = cyc;
+			last_ns = ptp;
+
+			if (gm_present && state != CLOCK_LOCKED)
+				printf("[CLOCK] Locked to grandmaster\n");
+			state = gm_present ? CLOCK_LOCKED : CLOCK_UNSYNCED;
+		} else {
+			/* Lost the grandmaster, keep the last rate */
+			if (state == CLOCK_LOCKED) {
+				printf("[CLOCK] Grandmaster lost, holdover\n");
+				state = CLOCK_HOLDOVER;
+				holdover_start = k_uptime_get();
+			}
+
+			m.base_ns = map_apply(&m, cyc);
+			m.base_cyc = cyc;
+			m.mult = rate;
+
+			if (k_uptime_get() - holdover_start > CONFIG_AVB_CLOCK_HOLDOVER_MS) {
+				printf("[CLOCK] Holdover expired, unsynced\n");
+				state = CLOCK_UNSYNCED;
+				last_ns = 0;
+			}
+		}
+
+		latch_write(&map_seq, map_latch, &m, sizeof(m));
+		atomic_set(&sync_state, state);
+
+#ifdef CONFIG_AVB_BENCH_CLOCK
+		/* Once the rate filter has settled */
+		if (++updates == (1 << RATE_FILTER_SHIFT) * 4)
+			bench_clock();
+#else
+		ARG_UNUSED(updates);
+#endif
+		k_sleep(K_MSEC(CONFIG_AVB_CLOCK_UPDATE_MS));
+	}
+}
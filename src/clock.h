@@ -0,0 +1,43 @@
+#pragma once
+#include <zephyr/kernel.h>
+
+/*
+ * Cached gPTP clock
+ *
+ * gptp_event_capture() is far too expensive to call for every sample.
+ * Instead clock_service() periodically samples gPTP time against the
+ * local cycle counter and fits a mapping (offset + rate), and now_ns()
+ * only applies that mapping to the cycle counter.
+ *
+ * If the grandmaster disappears, the last rate is kept and time is
+ * extrapolated (holdover) for CONFIG_AVB_CLOCK_HOLDOVER_MS before
+ * falling back to following the local gPTP clock.
+ */
+enum clock_sync {
+	CLOCK_UNSYNCED = 0,	/* no grandmaster, following local gPTP clock */
+	CLOCK_LOCKED,		/* following grandmaster time */
+	CLOCK_HOLDOVER,		/* grandmaster lost, extrapolating */
+};
+
+/* gPTP time in ns. Falls back to gptp_ts() until the first fit, from
+ * then on it never goes backwards; gPTP steps back are slewed out.
+ */
+uint64_t now_ns(void);
+
+/* gPTP time at a past (or future) k_cycle_get_32() reading, e.g. one
+ * taken in an ISR. Valid within +/- 2^31 cycles of now.
+ */
+uint64_t clock_cyc32_to_ns(uint32_t cyc);
+
+enum clock_sync clock_sync_state(void);
+
+/* True if now_ns() is in the grandmaster's time base (locked or in
+ * holdover), i.e. shared with the rest of the network.
+ */
+static inline bool clock_synced(void)
+{
+	return clock_sync_state() != CLOCK_UNSYNCED;
+}
+
+/* Worker refitting the mapping every CONFIG_AVB_CLOCK_UPDATE_MS */
+void clock_service(void);
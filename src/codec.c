@@ -0,0 +1,201 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "codec.h"
+
+#define WIDTH_BITS	6
+
+struct bitwriter {
+	uint8_t *buf;
+	size_t cap;
+	size_t pos;
+	uint64_t acc;
+	int nbits;
+	bool overflow;
+};
+
+struct bitreader {
+	const uint8_t *buf;
+	size_t len;
+	size_t pos;
+	uint64_t acc;
+	int nbits;
+	bool underflow;
+};
+
+static inline uint32_t zigzag(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline int bit_width(uint32_t v)
+{
+	return v ? 32 - __builtin_clz(v) : 0;
+}
+
+/* Append the low 'bits' bits of v, bits <= 32 */
+static void bw_put(struct bitwriter *bw, uint32_t v, int bits)
+{
+	if (!bits)
+		return;
+
+	if (bits < 32)
+		v &= (1UL << bits) - 1;
+	bw->acc |= (uint64_t)v << bw->nbits;
+	bw->nbits += bits;
+
+	while (bw->nbits >= 8) {
+		if (bw->pos < bw->cap)
+			bw->buf[bw->pos++] = (uint8_t)bw->acc;
+		else
+			bw->overflow = true;
+		bw->acc >>= 8;
+		bw->nbits -= 8;
+	}
+}
+
+static void bw_flush(struct bitwriter *bw)
+{
+	if (bw->nbits > 0)
+		bw_put(bw, 0, 8 - bw->nbits);
+}
+
+static uint32_t br_get(struct bitreader *br, int bits)
+{
+	uint32_t v;
+
+	if (!bits)
+		return 0;
+
+	while (br->nbits < bits) {
+		if (br->pos < br->len) {
+			br->acc |= (uint64_t)br->buf[br->pos++] << br->nbits;
+		} else {
+			br->underflow = true;
+		}
+		br->nbits += 8;
+	}
+
+	v = (uint32_t)br->acc;
+	if (bits < 32)
+		v &= (1UL << bits) - 1;
+	br->acc >>= bits;
+	br->nbits -= bits;
+	return v;
+}
+
+/* Max zig-zag value over the deltas of a data channel */
+static uint32_t chan_max(const int16_t *val, int nch, int c, int n)
+{
+	uint32_t m = 0;
+
+	for (int i = 1; i < n; i++) {
+		uint32_t z = zigzag((int32_t)val[i * nch + c] - val[(i - 1) * nch + c]);
+		m |= z;
+	}
+	return m;
+}
+
+/* Max zig-zag value over the second order deltas of the timestamps */
+static uint32_t ts_max(const uint32_t *ts, int n)
+{
+	uint32_t m = 0;
+
+	for (int i = 2; i < n; i++) {
+		int32_t dd = (int32_t)((ts[i] - ts[i - 1]) - (ts[i - 1] - ts[i - 2]));
+		m |= zigzag(dd);
+	}
+	return m;
+}
+
+/* OR-ing the zig-zag values gives the same bit width as the max and
+ * avoids a compare per sample.
+ */
+size_t codec_block_size(const uint32_t *ts, const int16_t *val, int nch, int n)
+{
+	size_t bits = 0;
+
+	if (n <= 0)
+		return 0;
+
+	bits += WIDTH_BITS + 32;
+	if (n >= 2)
+		bits += 32;
+	if (n >= 3)
+		bits += (size_t)(n - 2) * bit_width(ts_max(ts, n));
+
+	for (int c = 0; c < nch; c++)
+		bits += WIDTH_BITS + 16 + (size_t)(n - 1) * bit_width(chan_max(val, nch, c, n));
+
+	return (bits + 7) / 8;
+}
+
+int codec_encode_block(uint8_t *out, size_t cap,
+		const uint32_t *ts, const int16_t *val, int nch, int n)
+{
+	struct bitwriter bw = { .buf = out, .cap = cap };
+	int w;
+
+	if (n <= 0)
+		return 0;
+
+	/* Timestamps, 2nd order */
+	w = bit_width(ts_max(ts, n));
+	bw_put(&bw, w, WIDTH_BITS);
+	bw_put(&bw, ts[0], 32);
+	if (n >= 2)
+		bw_put(&bw, ts[1] - ts[0], 32);
+	for (int i = 2; i < n; i++) {
+		int32_t dd = (int32_t)((ts[i] - ts[i - 1]) - (ts[i - 1] - ts[i - 2]));
+		bw_put(&bw, zigzag(dd), w);
+	}
+
+	/* Data channels, 1st order */
+	for (int c = 0; c < nch; c++) {
+		w = bit_width(chan_max(val, nch, c, n));
+		bw_put(&bw, w, WIDTH_BITS);
+		bw_put(&bw, (uint16_t)val[c], 16);
+		for (int i = 1; i < n; i++)
+			bw_put(&bw, zigzag((int32_t)val[i * nch + c] - val[(i - 1) * nch + c]), w);
+	}
+	bw_flush(&bw);
+
+	return bw.overflow ? -ENOSPC : (int)bw.pos;
+}
+
+int codec_decode_block(const uint8_t *in, size_t len,
+		uint32_t *ts, int16_t *val, int nch, int n)
+{
+	struct bitreader br = { .buf = in, .len = len };
+	int w;
+
+	if (n <= 0)
+		return 0;
+
+	w = br_get(&br, WIDTH_BITS);
+	if (w > 32)
+		return -EINVAL;
+	ts[0] = br_get(&br, 32);
+	if (n >= 2)
+		ts[1] = ts[0] + br_get(&br, 32);
+	for (int i = 2; i < n; i++)
+		ts[i] = ts[i - 1] + (ts[i - 1] - ts[i - 2]) + unzigzag(br_get(&br, w));
+
+	for (int c = 0; c < nch; c++) {
+		w = br_get(&br, WIDTH_BITS);
+		if (w > 32)
+			return -EINVAL;
+		val[c] = (int16_t)br_get(&br, 16);
+		for (int i = 1; i < n; i++)
+			val[i * nch + c] = (int16_t)(val[(i - 1) * nch + c] + unzigzag(br_get(&br, w)));
+	}
+
+	/* Padding bits are dropped along with the accumulator */
+	return br.underflow ? -EINVAL : (int)br.pos;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Delta/zig-zag/bit-packing codec for blocks of sensor samples
+ *
+ * A block holds n samples of nch int16 channels plus a 32 bit
+ * timestamp per sample. Each channel is encoded separately as:
+ *
+ *    width   : 6 bits, bits per packed value (0..32)
+ *    first   : first value verbatim (16 bits, timestamps 32 bits)
+ *    packed  : zig-zag encoded deltas, 'width' bits each
+ *
+ * Data channels use first order deltas (x[i] - x[i-1]). Timestamps
+ * are close to periodic, so they use second order deltas: the first
+ * delta is stored verbatim (32 bits) after the first value, followed
+ * by the change in delta for the remaining samples.
+ *
+ * The timestamp channel comes first, then the data channels in order.
+ * Bits are written LSB first and the block is padded to a whole byte,
+ * so blocks can be concatenated.
+ *
+ * Encoding and decoding are O(n * nch) with no data dependent loops,
+ * i.e. bounded time for a bounded block size.
+ */
+
+/* Exact encoded size of a block in bytes */
+size_t codec_block_size(const uint32_t *ts, const int16_t *val, int nch, int n);
+
+/* Encode a block.
+ * @out: output buffer
+ * @cap: size of output buffer
+ * @ts:  n timestamps
+ * @val: n * nch values, sample-major (val[i * nch + c])
+ *
+ * Returns:
+ *    >0: bytes written
+ *    -ENOSPC: block does not fit in cap
+ */
+int codec_encode_block(uint8_t *out, size_t cap,
+		const uint32_t *ts, const int16_t *val, int nch, int n);
+
+/* Reference decoder, inverse of codec_encode_block().
+ *
+ * Returns:
+ *    >0: bytes consumed
+ *    -EINVAL: block is truncated or malformed
+ */
+int codec_decode_block(const uint8_t *in, size_t len,
+		uint32_t *ts, int16_t *val, int nch, int n);
@@ -2,12 +2,53 @@
 LOG_MODULE_REGISTER(avb_sensor_node, LOG_LEVEL_DBG);
 
 #include <zephyr/kernel.h>
+#include <zephyr/sys/barrier.h>
 
 #include <string.h> 		/* memset */
 #include <errno.h>
 #include <stdio.h>
 
 #include "common.h"
+#include "decim.h"
+#include "fusion.h"
+
+/* The rings index with a mask */
+BUILD_ASSERT(IS_POWER_OF_TWO(CONFIG_AVB_SAMPLE_RING_SIZE),
+	"AVB_SAMPLE_RING_SIZE must be a power of 2");
+
+/* Published rates, and with them Tx intervals, timestamps and fusion
+ * dt, are integer Hz
+ */
+#ifdef CONFIG_AVB_DECIMATE
+BUILD_ASSERT(CONFIG_AVB_GYRO_ODR_HZ % CONFIG_AVB_DECIMATE_FACTOR == 0,
+	"AVB_DECIMATE_FACTOR must divide AVB_GYRO_ODR_HZ");
+BUILD_ASSERT(CONFIG_AVB_ACCEL_ODR_HZ % CONFIG_AVB_DECIMATE_FACTOR == 0,
+	"AVB_DECIMATE_FACTOR must divide AVB_ACCEL_ODR_HZ");
+#endif
+
+/* Every sample produced during a Tx interval must fit in the ring,
+ * except for the single sensor_set format which coalesces them.
+ */
+#if !defined(CONFIG_AVB_PAYLOAD_MICRO) || CONFIG_AVB_BATCH_SIZE > 1
+BUILD_ASSERT((uint64_t)AVB_GYRO_RATE_HZ * AVB_GYRO_TX_INTERVAL_NS <
+	(uint64_t)CONFIG_AVB_SAMPLE_RING_SIZE * NSEC_PER_SEC,
+	"AVB_SAMPLE_RING_SIZE too small for gyro rate and Tx interval");
+BUILD_ASSERT((uint64_t)AVB_ACCEL_RATE_HZ * AVB_ACCEL_TX_INTERVAL_NS <
+	(uint64_t)CONFIG_AVB_SAMPLE_RING_SIZE * NSEC_PER_SEC,
+	"AVB_SAMPLE_RING_SIZE too small for accel rate and Tx interval");
+#endif
+#ifdef CONFIG_AVB_FUSION
+BUILD_ASSERT((uint64_t)AVB_GYRO_RATE_HZ * AVB_QUAT_TX_INTERVAL_NS <
+	(uint64_t)CONFIG_AVB_SAMPLE_RING_SIZE * NSEC_PER_SEC,
+	"AVB_SAMPLE_RING_SIZE too small for gyro rate and orientation Tx interval");
+#endif
+
+/* Backing storage for the per-sensor sample rings */
+static struct gyro_sample gyro_ring_buf[CONFIG_AVB_SAMPLE_RING_SIZE];
+static struct accel_sample accel_ring_buf[CONFIG_AVB_SAMPLE_RING_SIZE];
+#ifdef CONFIG_AVB_FUSION
+static struct quat_sample quat_ring_buf[CONFIG_AVB_SAMPLE_RING_SIZE];
+#endif
 
 int data_init(struct avb_sensor_data *data, int timeout_us)
 {
@@ -20,17 +61,37 @@ int data_init(struct avb_sensor_data *data, int timeout_us)
 	}
 
 	data->timeout = K_USEC(timeout_us);
-	data_get(data);
 
-	memset(data->accel, 0, sizeof(struct sensor_value)*3);
-	memset(data->magn, 0, sizeof(struct sensor_value)*3);
-	memset(&data->temp, 0, sizeof(struct sensor_value));
-	data->accel_ts = 0;
+	atomic_set(&data->accel_seq, 0);
+	memset(data->accel, 0, sizeof(data->accel));
+	data->accel_ctr = 0;
+
+	atomic_set(&data->gyro_seq, 0);
+	memset(data->gyro, 0, sizeof(data->gyro));
+	data->gyro_ctr = 0;
+
+	if (sample_ring_init(&data->accel_ring, accel_ring_buf,
+				sizeof(accel_ring_buf[0]), ARRAY_SIZE(accel_ring_buf)) ||
+		sample_ring_init(&data->gyro_ring, gyro_ring_buf,
+				sizeof(gyro_ring_buf[0]), ARRAY_SIZE(gyro_ring_buf))) {
+		printf("Failed initializing sample rings.\n");
+		return -EINVAL;
+	}
 
-	memset(data->gyro, 0, sizeof(struct sensor_value)*3);
-	data->gyro_ts = 0;
+#ifdef CONFIG_AVB_FUSION
+	atomic_set(&data->quat_seq, 0);
+	memset(data->quat, 0, sizeof(data->quat));
+	if (sample_ring_init(&data->quat_ring, quat_ring_buf,
+				sizeof(quat_ring_buf[0]), ARRAY_SIZE(quat_ring_buf))) {
+		printf("Failed initializing orientation ring.\n");
+		return -EINVAL;
+	}
+	fusion_init();
+#endif
 
-	data_put(data);
+#ifdef CONFIG_AVB_DECIMATE
+	decim_init();
+#endif
 	return 0;
 }
 
@@ -54,6 +115,114 @@ int data_put(struct avb_sensor_data *data)
 	return k_mutex_unlock(&data->lock);
 }
 
+/* Sequence latch, see struct avb_sensor_data
+ *
+ * The writer bumps the sequence to odd and updates copy 0, then bumps
+ * it to even and updates copy 1. A reader copies the entry selected by
+ * the low bit of the sequence, i.e. the one the writer is *not*
+ * touching, and retries if the sequence moved in the meantime.
+ */
+void latch_write(atomic_t *seq, void *latch, const void *src, size_t sz)
+{
+	atomic_inc(seq);
+	barrier_dmem_fence_full();
+	memcpy(latch, src, sz);
+	barrier_dmem_fence_full();
+
+	atomic_inc(seq);
+	barrier_dmem_fence_full();
+	memcpy((uint8_t *)latch + sz, src, sz);
+}
+
+void latch_read(atomic_t *seq, const void *latch, void *dst, size_t sz)
+{
+	atomic_val_t start;
+
+	do {
+		start = atomic_get(seq);
+		barrier_dmem_fence_full();
+		memcpy(dst, (const uint8_t *)latch + (start & 1) * sz, sz);
+		barrier_dmem_fence_full();
+	} while (atomic_get(seq) != start);
+}
+
+#ifdef CONFIG_AVB_FUSION
+static void fusion_publish(struct avb_sensor_data *data, const struct gyro_sample *gs)
+{
+	struct accel_sample as;
+	struct quat_sample qs;
+
+	data_snapshot_accel(data, &as);
+	fusion_update(gs, &as, &qs);
+	latch_write(&data->quat_seq, data->quat, &qs, sizeof(qs));
+	sample_ring_put(&data->quat_ring, &qs);
+}
+#endif
+
+void data_publish_gyro(struct avb_sensor_data *data, const struct gyro_sample *s)
+{
+#ifdef CONFIG_AVB_DECIMATE
+	struct gyro_sample out;
+
+	if (!decim_gyro(s, &out))
+		return;
+	s = &out;
+#endif
+	latch_write(&data->gyro_seq, data->gyro, s, sizeof(*s));
+	/* Nobody drains the raw rings when only orientation is sent */
+	if (!IS_ENABLED(CONFIG_AVB_FUSION_ONLY))
+		sample_ring_put(&data->gyro_ring, s);
+#ifdef CONFIG_AVB_FUSION
+	fusion_publish(data, s);
+#endif
+}
+
+void data_publish_accel(struct avb_sensor_data *data, const struct accel_sample *s)
+{
+#ifdef CONFIG_AVB_DECIMATE
+	struct accel_sample out;
+
+	if (!decim_accel(s, &out))
+		return;
+	s = &out;
+#endif
+	latch_write(&data->accel_seq, data->accel, s, sizeof(*s));
+	if (!IS_ENABLED(CONFIG_AVB_FUSION_ONLY))
+		sample_ring_put(&data->accel_ring, s);
+}
+
+void data_snapshot_gyro(struct avb_sensor_data *data, struct gyro_sample *s)
+{
+	latch_read(&data->gyro_seq, data->gyro, s, sizeof(*s));
+}
+
+void data_snapshot_accel(struct avb_sensor_data *data, struct accel_sample *s)
+{
+	latch_read(&data->accel_seq, data->accel, s, sizeof(*s));
+}
+
+#ifdef CONFIG_AVB_FUSION
+void data_snapshot_quat(struct avb_sensor_data *data, struct quat_sample *s)
+{
+	latch_read(&data->quat_seq, data->quat, s, sizeof(*s));
+}
+
+int data_drain_quat(struct avb_sensor_data *data, struct quat_sample *s)
+{
+	return sample_ring_get(&data->quat_ring, s);
+}
+#endif
+
+int data_drain_gyro(struct avb_sensor_data *data, struct gyro_sample *s)
+{
+	return sample_ring_get(&data->gyro_ring, s);
+}
+
+int data_drain_accel(struct avb_sensor_data *data, struct accel_sample *s)
+{
+	return sample_ring_get(&data->accel_ring, s);
+}
+
 int data_wait_ready(struct avb_sensor_data *data, int timeout_ms)
 {
 	int wait_ms = 0;
@@ -96,14 +265,19 @@ bool data_valid(struct avb_sensor_data *data)
 #include <zephyr/net/net_if.h>
 #include <zephyr/net/ethernet.h>
 
-uint64_t gptp_ts(void)
+uint64_t gptp_ts_gm(bool *gm_present)
 {
 	struct net_ptp_time ptpts;
-	bool gm_present;
-	gptp_event_capture(&ptpts, &gm_present);
+	gptp_event_capture(&ptpts, gm_present);
 	return ptpts.second * NSEC_PER_SEC + ptpts.nanosecond;
 }
 
+uint64_t gptp_ts(void)
+{
+	bool gm_present;
+	return gptp_ts_gm(&gm_present);
+}
+
 static struct gptp_phase_dis_cb phase_dis;
 static void gptp_phase_dis_cb(uint8_t *gm_identity,
 			      uint16_t *time_base,
@@ -1,12 +1,113 @@
 #pragma once
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/sensor.h>
+#include "sample_ring.h"
 enum avb_stream_class {
 	CLASS_NONE = 0,		/* do not use PCP and VLAN */
 	CLASS_A = 8000,		/* 125us - 8kHz */
 	CLASS_B = 4000		/* 250us - 4kHz */
 };
 
+/* How outgoing streams are shaped, see network_init() */
+enum avb_shaper {
+	AVB_SHAPER_CBS = 0,	/* 802.1Qav credit based, in SW */
+	AVB_SHAPER_TAS,		/* 802.1Qbv gate control list on gPTP time, in SW */
+};
+
+/* Tx interval of a stream whose fastest sensor publishes at odr_hz:
+ * CONFIG_AVB_TX_INTERVAL_US, or the time to produce a full batch.
+ */
+#if CONFIG_AVB_TX_INTERVAL_US > 0
+#define AVB_TX_INTERVAL_NS(odr_hz)	((uint64_t)CONFIG_AVB_TX_INTERVAL_US * NSEC_PER_USEC)
+#else
+#define AVB_TX_INTERVAL_NS(odr_hz)	((uint64_t)CONFIG_AVB_BATCH_SIZE * NSEC_PER_SEC / (odr_hz))
+#endif
+
+/* Rate at which samples are published, i.e. queued for Tx: the ODR,
+ * or a fraction of it with the decimating filter (decim.h).
+ */
+#ifdef CONFIG_AVB_DECIMATE
+#define AVB_GYRO_RATE_HZ	(CONFIG_AVB_GYRO_ODR_HZ / CONFIG_AVB_DECIMATE_FACTOR)
+#define AVB_ACCEL_RATE_HZ	(CONFIG_AVB_ACCEL_ODR_HZ / CONFIG_AVB_DECIMATE_FACTOR)
+#else
+#define AVB_GYRO_RATE_HZ	CONFIG_AVB_GYRO_ODR_HZ
+#define AVB_ACCEL_RATE_HZ	CONFIG_AVB_ACCEL_ODR_HZ
+#endif
+
+#define AVB_RATE_MAX_HZ	MAX(AVB_GYRO_RATE_HZ, AVB_ACCEL_RATE_HZ)
+
+/* Stream layout and Tx intervals set up by main() */
+#ifdef CONFIG_AVB_SPLIT_STREAMS
+#define AVB_GYRO_TX_INTERVAL_NS		AVB_TX_INTERVAL_NS(AVB_GYRO_RATE_HZ)
+#define AVB_ACCEL_TX_INTERVAL_NS	AVB_TX_INTERVAL_NS(AVB_ACCEL_RATE_HZ)
+#else
+#define AVB_GYRO_TX_INTERVAL_NS		AVB_TX_INTERVAL_NS(AVB_RATE_MAX_HZ)
+#define AVB_ACCEL_TX_INTERVAL_NS	AVB_TX_INTERVAL_NS(AVB_RATE_MAX_HZ)
+#endif
+
+/* The orientation stream follows the gyro, which drives the fusion */
+#define AVB_QUAT_TX_INTERVAL_NS		AVB_TX_INTERVAL_NS(AVB_GYRO_RATE_HZ)
+
+#if defined(CONFIG_AVB_STREAM_CLASS_A)
+#define AVB_STREAM_CLASS	CLASS_A
+#elif defined(CONFIG_AVB_STREAM_CLASS_B)
+#define AVB_STREAM_CLASS	CLASS_B
+#else
+#define AVB_STREAM_CLASS	CLASS_NONE
+#endif
+
+/* Sensors carried in a stream, see network_add_stream() */
+enum avb_sensor {
+	AVB_SENSOR_GYRO  = BIT(0),	/* FXAS21002 */
+	AVB_SENSOR_ACCEL = BIT(1),	/* FXOS8700: accel, magn & temp */
+	AVB_SENSOR_ALL   = AVB_SENSOR_GYRO | AVB_SENSOR_ACCEL,
+	AVB_SENSOR_QUAT  = BIT(2),	/* orientation from the fusion stage */
+};
+
+/* Sensor devicetree nodes. The avb-gyro/avb-accel aliases select other
+ * devices (e.g. the synthetic IMU on native_sim), the FXAS21002 and
+ * FXOS8700 are used otherwise.
+ */
+#if DT_NODE_EXISTS(DT_ALIAS(avb_gyro))
+#define AVB_GYRO_NODE DT_ALIAS(avb_gyro)
+#else
+#define AVB_GYRO_NODE DT_INST(0, nxp_fxas21002)
+#endif
+
+#if DT_NODE_EXISTS(DT_ALIAS(avb_accel))
+#define AVB_ACCEL_NODE DT_ALIAS(avb_accel)
+#else
+#define AVB_ACCEL_NODE DT_INST(0, nxp_fxos8700)
+#endif
+
+/*
+ * Samples are converted to micro-units (the unit of struct sensor_set)
+ * by the collectors at capture time, so the Tx path only copies them.
+ * The layout matches struct gyro_set/accel_set in payload.h.
+ */
+
+/* Latest reading from the FXAS21002, urad/s */
+struct gyro_sample {
+	int64_t gyro[3];
+	uint64_t ts;
+};
+
+/* Latest reading from the FXOS8700: um/s^2, ugauss and u°C */
+struct accel_sample {
+	int64_t accel[3];
+	int64_t magn[3];
+	int64_t temp;
+	uint64_t ts;
+};
+
+/* Orientation from the fusion stage, unit quaternion w, x, y, z in
+ * Q14 (1.0 = 16384)
+ */
+struct quat_sample {
+	int16_t q[4];
+	uint64_t ts;
+};
+
 struct avb_sensor_data {
 	struct k_mutex lock;
 	k_timeout_t timeout;
@@ -15,17 +116,44 @@ struct avb_sensor_data {
 	bool ready;
 	bool running;
 
+	/*
+	 * Sensor readings are published through a sequence latch (two
+	 * copies and a sequence counter) rather than under the lock.
+	 *
+	 * Each latch has exactly one writer (its collector) which never
+	 * blocks, and a reader always finds one stable copy, so the
+	 * Tx-thread never waits for a collector stuck in an I2C
+	 * transfer. A reader retries whenever the sequence moved while
+	 * it was copying, a half finished update included, but the copy
+	 * it retries on is never the one being written.
+	 *
+	 * In addition to the latest value, every sample is queued in a
+	 * per-sensor SPSC ring which the network sender drains once per
+	 * frame, so samples produced faster than the Tx rate are not
+	 * silently overwritten. ->dropped in the ring counts samples lost
+	 * because the sender fell behind.
+	 */
+
 	/* Accel, magnetometer & temp from once device */
-	struct sensor_value accel[3];
-	struct sensor_value magn[3];
-	struct sensor_value temp;
-	uint64_t accel_ts;
+	atomic_t accel_seq;
+	struct accel_sample accel[2];
+	struct sample_ring accel_ring;
 	uint64_t accel_ctr;
 
 	/* GYRO is read from another device */
-	struct sensor_value gyro[3];
-	uint64_t gyro_ts;
+	atomic_t gyro_seq;
+	struct gyro_sample gyro[2];
+	struct sample_ring gyro_ring;
 	uint64_t gyro_ctr;
+
+#ifdef CONFIG_AVB_FUSION
+	/* Fused from every gyro sample and the latest accel/magn, by the
+	 * gyro's collector.
+	 */
+	atomic_t quat_seq;
+	struct quat_sample quat[2];
+	struct sample_ring quat_ring;
+#endif
 };
 
 /*
@@ -45,6 +173,40 @@ int data_init(struct avb_sensor_data *d, int timeout_us);
 int data_get(struct avb_sensor_data *d);
 int data_put(struct avb_sensor_data *d);
 
+/* Publish a new sample from a collector. Never blocks, must only be
+ * called from the collector owning the sensor.
+ *
+ * The sample becomes the latest value and is queued in the sensor's
+ * sample ring. With CONFIG_AVB_DECIMATE only the filtered output,
+ * every AVB_DECIMATE_FACTOR samples, is published (decim.h). With
+ * CONFIG_AVB_FUSION every published gyro sample also updates and
+ * publishes the orientation (fusion.h).
+ */
+void data_publish_gyro(struct avb_sensor_data *d, const struct gyro_sample *s);
+void data_publish_accel(struct avb_sensor_data *d, const struct accel_sample *s);
+
+/* Take a consistent copy of the latest published sample. Lock-free,
+ * retries only if a new sample was published during the copy.
+ */
+void data_snapshot_gyro(struct avb_sensor_data *d, struct gyro_sample *s);
+void data_snapshot_accel(struct avb_sensor_data *d, struct accel_sample *s);
+void data_snapshot_quat(struct avb_sensor_data *d, struct quat_sample *s);
+
+/* Pop the oldest queued sample, consumer side of the sample rings.
+ *
+ * Returns 0 on success, -EAGAIN when no new samples are available.
+ */
+int data_drain_gyro(struct avb_sensor_data *d, struct gyro_sample *s);
+int data_drain_accel(struct avb_sensor_data *d, struct accel_sample *s);
+int data_drain_quat(struct avb_sensor_data *d, struct quat_sample *s);
+
+/* Sequence latch (two copies of sz bytes and a sequence counter) with
+ * a single writer, see struct avb_sensor_data. latch points to the
+ * two copies.
+ */
+void latch_write(atomic_t *seq, void *latch, const void *src, size_t sz);
+void latch_read(atomic_t *seq, const void *latch, void *dst, size_t sz);
+
 /* Wait for data to become available.
  * Needed at:
  *    - startup, when sensor setup is still running
@@ -58,7 +220,20 @@ int data_wait_ready(struct avb_sensor_data *data, int timeout_ms);
  */
 bool data_valid(struct avb_sensor_data *data);
 
+/* Run the startup micro-benchmarks selected with CONFIG_AVB_BENCH_* */
+void bench_run(void);
+
+/* Cost and accuracy of now_ns() vs. gptp_ts(), run from
+ * clock_service() once the mapping has settled.
+ */
+void bench_clock(void);
+
 uint64_t gptp_ts(void);
+
+/* gPTP time, gm_present is set if synchronized to a grandmaster, i.e.
+ * the time is shared with the rest of the network.
+ */
+uint64_t gptp_ts_gm(bool *gm_present);
 void gptp_init(void);
 
 int gyro_init(struct avb_sensor_data *sensor_data);
@@ -67,28 +242,88 @@ void gyro_collector(void);
 int accel_init(struct avb_sensor_data *sensor_data);
 void accel_collector(void);
 
-/* We are currently sending *a single stream*
- *
- * Initialize the network, set addresses, ready CBS credit calculation
- * etc.
+/* Initialize the network, set addresses, ready Tx and Rx sockets etc.
  *
  * sensor_data: containing struct for data. We expect the data to be
  * updated asynhcronously and will send whatever's in the buffer when
- * CBS allows us to
+ * the shaper allows us to
+ *
+ * shaper: AVB_SHAPER_CBS sends as fast as each stream's credit allows.
+ * AVB_SHAPER_TAS (needs CONFIG_AVB_TAS) opens a Tx window per stream at
+ * a fixed phase of a cycle aligned to gPTP time and releases a single
+ * frame at the start of it, so all nodes send at known instants.
+ *
+ * Streams are added afterwards with network_add_stream().
+ */
+int network_init(struct avb_sensor_data *sensor_data, enum avb_shaper shaper);
+
+/* Add an outgoing stream, with its own stream ID, PCP and CBS state.
+ *
+ * sensors: enum avb_sensor mask of the sensors carried in the stream.
+ * A sensor should only be carried in a single stream, as samples are
+ * drained from its ring by whichever stream sends first.
  *
  * tx_interval: Target interval. This is used as input to the CBS
  * machinery to compute the correct idleSlope which in turn will send
  * data at the desired rate.
+ *
+ * Must be called before data is marked ready. Returns the stream index
+ * or a negative error.
  */
-int network_init(struct avb_sensor_data *sensor_data,
+int network_add_stream(unsigned int sensors,
 		uint64_t tx_interval_ns,
 		enum avb_stream_class sc);
 
-/* Worker sending data from as quickly as CBS will allow it to.
+/* Running counters of a stream, since it was added or the last
+ * network_stats_reset().
+ */
+struct avb_stream_stats {
+	unsigned int sensors;
+	enum avb_stream_class sc;
+
+	uint32_t frames_sent;
+	uint32_t send_failed;		/* rejected by the stack */
+	uint32_t skipped_empty;		/* no data, or not ready yet */
+	uint32_t skipped_nobufs;	/* Tx packet pool exhausted */
+	uint32_t gate_missed;		/* TAS window missed */
+	uint32_t ring_dropped;		/* samples lost in the stream's rings */
+
+	/* Credit range when charging frames, bits, and frames that took
+	 * it below loCredit
+	 */
+	int credit_min;
+	int credit_max;
+	int lo_credit;
+	int hi_credit;
+	uint32_t credit_underflows;
+
+	/* Time frames waited for CBS credit */
+	uint64_t credit_wait_ns;
+	uint32_t credit_wait_max_ns;
+
+	/* Achieved: bits_sent over elapsed_ns, configured: idle_slope */
+	uint64_t bits_sent;
+	uint64_t elapsed_ns;
+	int64_t idle_slope;
+};
+
+/* Copy of the counters of stream idx (as returned from
+ * network_add_stream()), counters may be mid-update. Returns -EINVAL
+ * for an unknown stream.
+ */
+int network_stream_stats(int idx, struct avb_stream_stats *st);
+
+/* Request all stream counters to be cleared, carried out by the sender
+ * before its next frame.
+ */
+void network_stats_reset(void);
+
+/* Worker sending data from all streams as quickly as the shaper will
+ * allow.
  *
- * The design hinges on a single sender (this thread) sending sensor
- * data of a known size. It does not currently support multiple outgoing
- * streams.
+ * A single thread serves every stream in strict class priority (Class
+ * A before Class B before CLASS_NONE). With CBS each stream is shaped
+ * by its own credit, with TAS by its gate window.
  */
 void network_sender(void);
 
@@ -100,11 +335,8 @@ void network_sender(void);
  *
  * [00:12:17.839,000] <err> net_pkt: Data buffer (68) allocation failed.
  *
+ * With CONFIG_NET_PKT_FILTER, our own looped back frames are dropped
+ * by a packet filter rule before they reach the socket.
  */
 void network_rx_drain(void);
 
-/* Worker that periodically refills the credits. Once credits reaches >=
- * 0, potential waiters are signalled.
- */
-void network_cbs_refill(void);
-
@@ -0,0 +1,180 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <arm_math.h>
+#include <math.h>
+#include <string.h>
+
+#include "decim.h"
+
+#ifdef CONFIG_AVB_DECIMATE_Q31
+typedef q31_t decim_t;
+typedef arm_fir_decimate_instance_q31 decim_inst_t;
+#define DECIM_FRAC_BITS		31
+#define decim_kernel_init	arm_fir_decimate_init_q31
+#define decim_kernel		arm_fir_decimate_q31
+#else
+typedef q15_t decim_t;
+typedef arm_fir_decimate_instance_q15 decim_inst_t;
+#define DECIM_FRAC_BITS		15
+#define decim_kernel_init	arm_fir_decimate_init_q15
+#define decim_kernel		arm_fir_decimate_q15
+#endif
+
+#define DECIM_ONE	((double)BIT64(DECIM_FRAC_BITS))
+#define DECIM_MAX	((int64_t)BIT64(DECIM_FRAC_BITS) - 1)
+
+/* Full scale per channel, log2 of micro-units */
+#define FS_GYRO		26	/* 67 rad/s, FXAS21002 2000 dps is 35 rad/s */
+#define FS_ACCEL	27	/* 134 m/s^2, FXOS8700 8 g is 78 m/s^2 */
+#define FS_MAGN		24	/* 16.7 gauss, FXOS8700 is +-12 gauss */
+#define FS_TEMP		27	/* 134 degC */
+
+#define DECIM_MAX_CH	7
+
+struct decim_sensor {
+	int n_ch;
+	const uint8_t *fs;
+	bool primed;
+	int fill;		/* inputs in block */
+	uint64_t first_ts;	/* timestamp of block[][0] */
+
+	decim_inst_t inst[DECIM_MAX_CH];
+	decim_t state[DECIM_MAX_CH][DECIM_TAPS + DECIM_FACTOR - 1];
+	decim_t block[DECIM_MAX_CH][DECIM_FACTOR];
+};
+
+static const uint8_t gyro_fs[] = { FS_GYRO, FS_GYRO, FS_GYRO };
+static const uint8_t accel_fs[] = {
+	FS_ACCEL, FS_ACCEL, FS_ACCEL,
+	FS_MAGN, FS_MAGN, FS_MAGN,
+	FS_TEMP,
+};
+
+static decim_t coeffs[DECIM_TAPS];
+
+static struct decim_sensor gyro_dec = {
+	.n_ch = ARRAY_SIZE(gyro_fs),
+	.fs = gyro_fs,
+};
+
+static struct decim_sensor accel_dec = {
+	.n_ch = ARRAY_SIZE(accel_fs),
+	.fs = accel_fs,
+};
+
+static inline decim_t to_fixed(int64_t micro, uint8_t fs)
+{
+	int64_t lim = (int64_t)BIT64(fs) - 1;
+
+	micro = CLAMP(micro, -lim, lim);
+	return (decim_t)((micro * (int64_t)BIT64(DECIM_FRAC_BITS)) >> fs);
+}
+
+static inline int64_t from_fixed(decim_t v, uint8_t fs)
+{
+	return ((int64_t)v * (int64_t)BIT64(fs)) >> DECIM_FRAC_BITS;
+}
+
+/* Hamming windowed sinc, cut-off at 80% of the output Nyquist */
+static double fir_tap(int n)
+{
+	const double fc = 0.4 / DECIM_FACTOR;	/* cycles per input sample */
+	double x = n - (DECIM_TAPS - 1) / 2.0;
+	double h = x == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * x) / (M_PI * x);
+
+	return h * (0.54 - 0.46 * cos(2.0 * M_PI * n / (DECIM_TAPS - 1)));
+}
+
+static void decim_reset(struct decim_sensor *d)
+{
+	for (int c = 0; c < d->n_ch; c++)
+		decim_kernel_init(&d->inst[c], DECIM_TAPS, DECIM_FACTOR, coeffs,
+				d->state[c], DECIM_FACTOR);
+	d->primed = false;
+	d->fill = 0;
+}
+
+void decim_init(void)
+{
+	double sum = 0.0;
+
+	/* Unity gain at DC */
+	for (int n = 0; n < DECIM_TAPS; n++)
+		sum += fir_tap(n);
+	for (int n = 0; n < DECIM_TAPS; n++) {
+		int64_t q = llround(fir_tap(n) / sum * DECIM_ONE);
+
+		coeffs[n] = (decim_t)CLAMP(q, -DECIM_MAX, DECIM_MAX);
+	}
+
+	decim_reset(&gyro_dec);
+	decim_reset(&accel_dec);
+}
+
+/* Fill the delay line with the first sample, so the filter starts out
+ * settled instead of ramping up from 0 (which takes the temperature and
+ * the 1 g on accel Z a full filter length).
+ */
+static void decim_prime(struct decim_sensor *d, const int64_t *in)
+{
+	decim_t y;
+
+	for (int c = 0; c < d->n_ch; c++) {
+		for (int i = 0; i < DECIM_FACTOR; i++)
+			d->block[c][i] = to_fixed(in[c], d->fs[c]);
+		for (int i = 0; i < DIV_ROUND_UP(DECIM_TAPS, DECIM_FACTOR); i++)
+			decim_kernel(&d->inst[c], d->block[c], &y, DECIM_FACTOR);
+	}
+	d->primed = true;
+}
+
+static bool decim_feed(struct decim_sensor *d, const int64_t *in, uint64_t ts,
+		int64_t *out, uint64_t *out_ts)
+{
+	if (!d->primed)
+		decim_prime(d, in);
+
+	if (d->fill == 0)
+		d->first_ts = ts;
+	for (int c = 0; c < d->n_ch; c++)
+		d->block[c][d->fill] = to_fixed(in[c], d->fs[c]);
+	if (++d->fill < DECIM_FACTOR)
+		return false;
+	d->fill = 0;
+
+	for (int c = 0; c < d->n_ch; c++) {
+		decim_t y;
+
+		decim_kernel(&d->inst[c], d->block[c], &y, DECIM_FACTOR);
+		out[c] = from_fixed(y, d->fs[c]);
+	}
+
+	/* Group delay, with the input period seen over this block */
+	uint64_t period = (ts - d->first_ts) / (DECIM_FACTOR - 1);
+
+	*out_ts = ts - period * (DECIM_TAPS - 1) / 2;
+	return true;
+}
+
+bool decim_gyro(const struct gyro_sample *in, struct gyro_sample *out)
+{
+	return decim_feed(&gyro_dec, in->gyro, in->ts, out->gyro, &out->ts);
+}
+
+bool decim_accel(const struct accel_sample *in, struct accel_sample *out)
+{
+	int64_t v[DECIM_MAX_CH] = {
+		in->accel[0], in->accel[1], in->accel[2],
+		in->magn[0], in->magn[1], in->magn[2],
+		in->temp,
+	};
+	int64_t y[DECIM_MAX_CH];
+
+	if (!decim_feed(&accel_dec, v, in->ts, y, &out->ts))
+		return false;
+
+	memcpy(out->accel, &y[0], sizeof(out->accel));
+	memcpy(out->magn, &y[3], sizeof(out->magn));
+	out->temp = y[6];
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+#include "common.h"
+
+/*
+ * Decimating anti-alias filter
+ *
+ * Sits in data_publish_gyro()/data_publish_accel(), i.e. between the
+ * collectors and the sample rings drained by pdu_add_data(). Every
+ * channel goes through a low-pass FIR (CMSIS-DSP
+ * arm_fir_decimate_q15/q31) and one in CONFIG_AVB_DECIMATE_FACTOR
+ * samples is published.
+ *
+ * Samples are converted from micro-units to fixed-point against a
+ * per-channel power-of-two full scale (a shift, no division) that
+ * covers the widest range of the FXAS21002/FXOS8700, and back.
+ *
+ * The filter is linear phase, the output lags the newest input by
+ * (taps - 1) / 2 input periods. The output timestamp is moved back by
+ * that, with the period taken from the timestamps of the block.
+ */
+#define DECIM_FACTOR	CONFIG_AVB_DECIMATE_FACTOR
+#define DECIM_TAPS	CONFIG_AVB_DECIMATE_TAPS
+
+/* Design the filter and reset all channels */
+void decim_init(void);
+
+/* Feed one sample, returns true and fills out when a decimated sample
+ * is ready. Single caller per sensor (its collector).
+ */
+bool decim_gyro(const struct gyro_sample *in, struct gyro_sample *out);
+bool decim_accel(const struct accel_sample *in, struct accel_sample *out);
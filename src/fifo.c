@@ -0,0 +1,141 @@
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/i2c.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "common.h"
+#include "fifo.h"
+#ifdef CONFIG_SYNTH_IMU
+#include "synth_imu.h"
+#endif
+
+/* A full burst must fit in the sample ring until the sender drains it */
+BUILD_ASSERT(CONFIG_AVB_SAMPLE_RING_SIZE >= 2 * CONFIG_AVB_SENSOR_FIFO_WATERMARK,
+	"AVB_SAMPLE_RING_SIZE too small for the FIFO watermark");
+
+/* Reject period measurements further off than this from nominal */
+#define PERIOD_TOL_SHIFT	4	/* 1/16, ~6% */
+#define PERIOD_IIR_SHIFT	3
+
+static int fifo_burst_setup(struct fifo_burst *f, uint8_t rec_sz,
+		uint8_t watermark, uint32_t odr_mhz)
+{
+	if (!odr_mhz || !watermark || watermark >= FIFO_MAX_RECORDS)
+		return -EINVAL;
+
+	f->rec_sz = rec_sz;
+	f->watermark = watermark;
+
+	f->nominal_q16 = ((uint64_t)sys_clock_hw_cycles_per_sec() << 16) * 1000 / odr_mhz;
+	f->period_q16 = f->nominal_q16;
+
+	f->anchor_cyc = k_cycle_get_32();
+	f->anchor_idx = 0;
+	f->total = 0;
+	f->prev_valid = false;
+	f->bursts = 0;
+	f->overflows = 0;
+	return 0;
+}
+
+int fifo_burst_init(struct fifo_burst *f, const struct i2c_dt_spec *bus,
+		uint8_t status_reg, uint8_t data_reg, uint8_t rec_sz,
+		uint8_t watermark, uint32_t odr_mhz)
+{
+	if (!f || !bus)
+		return -EINVAL;
+
+	f->bus = bus;
+	f->status_reg = status_reg;
+	f->data_reg = data_reg;
+#ifdef CONFIG_SYNTH_IMU
+	f->synth = NULL;
+#endif
+	return fifo_burst_setup(f, rec_sz, watermark, odr_mhz);
+}
+
+#ifdef CONFIG_SYNTH_IMU
+int fifo_burst_init_synth(struct fifo_burst *f, const struct device *dev,
+		uint8_t watermark, uint32_t odr_mhz)
+{
+	if (!f || !dev)
+		return -EINVAL;
+
+	f->bus = NULL;
+	f->synth = dev;
+	return fifo_burst_setup(f, SYNTH_IMU_FIFO_REC_SZ, watermark, odr_mhz);
+}
+#endif
+
+static int fifo_status(struct fifo_burst *f, uint8_t *status)
+{
+#ifdef CONFIG_SYNTH_IMU
+	if (f->synth)
+		return synth_imu_fifo_status(f->synth, status);
+#endif
+	return i2c_reg_read_byte_dt(f->bus, f->status_reg, status);
+}
+
+static int fifo_records(struct fifo_burst *f, uint8_t *buf, int n)
+{
+#ifdef CONFIG_SYNTH_IMU
+	if (f->synth)
+		return synth_imu_fifo_read(f->synth, buf, n) == n ? 0 : -EIO;
+#endif
+	return i2c_burst_read_dt(f->bus, f->data_reg, buf, n * f->rec_sz);
+}
+
+static void period_update(struct fifo_burst *f, uint32_t irq_cyc, uint32_t seq)
+{
+	if (f->prev_valid && seq != f->prev_irq_seq) {
+		uint64_t meas = ((uint64_t)(irq_cyc - f->prev_irq_cyc) << 16) / (seq - f->prev_irq_seq);
+		uint64_t tol = f->nominal_q16 >> PERIOD_TOL_SHIFT;
+
+		if (meas + tol > f->nominal_q16 && meas < f->nominal_q16 + tol)
+			f->period_q16 += ((int64_t)meas - (int64_t)f->period_q16) >> PERIOD_IIR_SHIFT;
+	}
+	f->prev_irq_cyc = irq_cyc;
+	f->prev_irq_seq = seq;
+	f->prev_valid = true;
+}
+
+int fifo_burst_read(struct fifo_burst *f, bool irq, uint32_t irq_cyc, uint8_t *buf)
+{
+	uint32_t read_cyc = k_cycle_get_32();
+	uint8_t status;
+
+	/* Reading F_STATUS also clears the FIFO interrupt */
+	int ret = fifo_status(f, &status);
+	if (ret)
+		return ret;
+
+	int n = status & FIFO_STATUS_CNT_MASK;
+	if (!n)
+		return 0;
+
+	ret = fifo_records(f, buf, n);
+	if (ret)
+		return ret;
+
+	f->bursts++;
+	if (status & FIFO_STATUS_OVF) {
+		/* Samples were lost, the interrupt no longer tells which
+		 * record it belonged to
+		 */
+		f->overflows++;
+		f->prev_valid = false;
+		irq = false;
+	}
+
+	if (irq && n >= f->watermark) {
+		f->anchor_idx = f->watermark - 1;
+		f->anchor_cyc = irq_cyc;
+		period_update(f, irq_cyc, f->total + f->anchor_idx);
+	} else {
+		f->anchor_idx = n - 1;
+		f->anchor_cyc = read_cyc;
+	}
+	f->total += n;
+
+	return n;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/i2c.h>
+
+/*
+ * Sensor FIFO burst acquisition
+ *
+ * FXAS21002 and FXOS8700 both have a 32 sample FIFO with a watermark
+ * interrupt. Instead of one interrupt, one I2C transfer and one
+ * collector wake-up per sample, the collector is woken once the FIFO
+ * holds a watermark's worth of samples and drains all of it with a
+ * status read and a single burst read (the output registers wrap
+ * around per record while the FIFO is enabled).
+ *
+ * The samples carry no timestamp of their own. The watermark interrupt
+ * is stamped in the ISR (capture.h) and marks the arrival of record
+ * watermark - 1, the others are placed before and after it at the
+ * sample period. The period starts out nominal from the ODR and is
+ * tracked from the spacing of the interrupts, as the sensor's own
+ * oscillator is only accurate to a few percent.
+ *
+ * The chip specific setup (FIFO mode, watermark and interrupt routing)
+ * is done by the collectors, this only knows the status and data
+ * registers. On native_sim the synthetic IMU's FIFO emulation is read
+ * instead (synth_imu.h), with the same status layout.
+ */
+#define FIFO_MAX_RECORDS	32
+#define FIFO_STATUS_OVF		BIT(7)
+#define FIFO_STATUS_CNT_MASK	0x3f
+
+struct fifo_burst {
+	const struct i2c_dt_spec *bus;
+#ifdef CONFIG_SYNTH_IMU
+	/* Synthetic IMU instead of the I2C part if set */
+	const struct device *synth;
+#endif
+	uint8_t status_reg;	/* F_STATUS: overflow and sample count */
+	uint8_t data_reg;	/* first output register of a record */
+	uint8_t rec_sz;		/* bytes per record */
+	uint8_t watermark;
+
+	/* Sample period, cycles in Q16 */
+	uint64_t nominal_q16;
+	uint64_t period_q16;
+
+	/* Time (k_cycle_get_32()) of record anchor_idx in the last read */
+	uint32_t anchor_cyc;
+	int anchor_idx;
+
+	/* Samples read so far, and the sample the previous watermark
+	 * interrupt belonged to (for the period estimate)
+	 */
+	uint32_t total;
+	uint32_t prev_irq_cyc;
+	uint32_t prev_irq_seq;
+	bool prev_valid;
+
+	uint32_t bursts;
+	uint32_t overflows;
+};
+
+/* odr_mhz: nominal output data rate in mHz */
+int fifo_burst_init(struct fifo_burst *f, const struct i2c_dt_spec *bus,
+		uint8_t status_reg, uint8_t data_reg, uint8_t rec_sz,
+		uint8_t watermark, uint32_t odr_mhz);
+
+#ifdef CONFIG_SYNTH_IMU
+/* Same on the FIFO emulation of a synthetic IMU, records are
+ * SYNTH_IMU_FIFO_REC_SZ bytes
+ */
+int fifo_burst_init_synth(struct fifo_burst *f, const struct device *dev,
+		uint8_t watermark, uint32_t odr_mhz);
+#endif
+
+/* Drain the FIFO into buf (room for FIFO_MAX_RECORDS records).
+ *
+ * irq tells if the collector was woken by the watermark interrupt
+ * (stamped at irq_cyc) rather than by a timeout. Without it, or after
+ * an overflow, the newest record is placed at the time of the read.
+ *
+ * Returns the number of records read, or negative errno.
+ */
+int fifo_burst_read(struct fifo_burst *f, bool irq, uint32_t irq_cyc, uint8_t *buf);
+
+/* k_cycle_get_32() time of record i (oldest first) of the last read */
+static inline uint32_t fifo_burst_ts(const struct fifo_burst *f, int i)
+{
+	int64_t d = (int64_t)(i - f->anchor_idx) * (int64_t)f->period_q16;
+
+	return f->anchor_cyc + (int32_t)(d / (1 << 16));
+}
+
+/* How long to wait for the watermark before polling the FIFO anyway,
+ * e.g. if an edge was lost.
+ */
+static inline k_timeout_t fifo_burst_timeout(const struct fifo_burst *f)
+{
+	return K_CYC((2 * f->watermark * f->period_q16) >> 16);
+}
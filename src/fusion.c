@@ -0,0 +1,137 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <math.h>
+
+#include "fusion.h"
+
+#define TWO_KP		(2.0f * CONFIG_AVB_FUSION_KP_MILLI / 1000.0f)
+#define TWO_KI		(2.0f * CONFIG_AVB_FUSION_KI_MILLI / 1000.0f)
+
+/* Time step bounds, s. The first sample and gaps use the nominal one. */
+#define DT_NOMINAL	(1.0f / AVB_GYRO_RATE_HZ)
+#define DT_MAX		0.1f
+
+#define Q14_ONE		16384.0f
+
+static struct {
+	float q0, q1, q2, q3;
+	float ix, iy, iz;	/* integral feedback */
+	uint64_t last_ts;
+} f;
+
+void fusion_init(void)
+{
+	f.q0 = 1.0f;
+	f.q1 = f.q2 = f.q3 = 0.0f;
+	f.ix = f.iy = f.iz = 0.0f;
+	f.last_ts = 0;
+}
+
+static inline int16_t to_q14(float v)
+{
+	return (int16_t)CLAMP(lrintf(v * Q14_ONE), INT16_MIN, INT16_MAX);
+}
+
+/* gx..gz in rad/s, accel and magn in any unit, dt in s */
+static void mahony(float gx, float gy, float gz, float ax, float ay, float az,
+		float mx, float my, float mz, float dt)
+{
+	float q0 = f.q0, q1 = f.q1, q2 = f.q2, q3 = f.q3;
+	float n = ax * ax + ay * ay + az * az;
+
+	/* No correction while accel is unknown (0) */
+	if (n > 0.0f) {
+		float halfwx = 0.0f, halfwy = 0.0f, halfwz = 0.0f;
+		float ex, ey, ez;
+
+		n = 1.0f / sqrtf(n);
+		ax *= n;
+		ay *= n;
+		az *= n;
+
+		/* Estimated direction of gravity */
+		float halfvx = q1 * q3 - q0 * q2;
+		float halfvy = q0 * q1 + q2 * q3;
+		float halfvz = q0 * q0 - 0.5f + q3 * q3;
+
+		n = mx * mx + my * my + mz * mz;
+		if (n > 0.0f) {
+			float q0q1 = q0 * q1, q0q2 = q0 * q2, q0q3 = q0 * q3;
+			float q1q1 = q1 * q1, q1q2 = q1 * q2, q1q3 = q1 * q3;
+			float q2q2 = q2 * q2, q2q3 = q2 * q3, q3q3 = q3 * q3;
+
+			n = 1.0f / sqrtf(n);
+			mx *= n;
+			my *= n;
+			mz *= n;
+
+			/* Earth's field in the earth frame, x north, z down */
+			float hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+			float hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+			float bx = sqrtf(hx * hx + hy * hy);
+			float bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+			/* Estimated direction of the field */
+			halfwx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+			halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+			halfwz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+		}
+
+		/* Error is the cross product of measured and estimated */
+		ex = (ay * halfvz - az * halfvy) + (my * halfwz - mz * halfwy);
+		ey = (az * halfvx - ax * halfvz) + (mz * halfwx - mx * halfwz);
+		ez = (ax * halfvy - ay * halfvx) + (mx * halfwy - my * halfwx);
+
+		if (TWO_KI > 0.0f) {
+			f.ix += TWO_KI * ex * dt;
+			f.iy += TWO_KI * ey * dt;
+			f.iz += TWO_KI * ez * dt;
+			gx += f.ix;
+			gy += f.iy;
+			gz += f.iz;
+		}
+		gx += TWO_KP * ex;
+		gy += TWO_KP * ey;
+		gz += TWO_KP * ez;
+	}
+
+	/* Integrate the rate of change of the quaternion */
+	gx *= 0.5f * dt;
+	gy *= 0.5f * dt;
+	gz *= 0.5f * dt;
+	f.q0 = q0 + (-q1 * gx - q2 * gy - q3 * gz);
+	f.q1 = q1 + (q0 * gx + q2 * gz - q3 * gy);
+	f.q2 = q2 + (q0 * gy - q1 * gz + q3 * gx);
+	f.q3 = q3 + (q0 * gz + q1 * gy - q2 * gx);
+
+	n = 1.0f / sqrtf(f.q0 * f.q0 + f.q1 * f.q1 + f.q2 * f.q2 + f.q3 * f.q3);
+	f.q0 *= n;
+	f.q1 *= n;
+	f.q2 *= n;
+	f.q3 *= n;
+}
+
+void fusion_update(const struct gyro_sample *g, const struct accel_sample *a,
+		struct quat_sample *out)
+{
+	float dt = DT_NOMINAL;
+
+	if (f.last_ts && g->ts > f.last_ts) {
+		float step = (g->ts - f.last_ts) / 1e9f;
+
+		if (step < DT_MAX)
+			dt = step;
+	}
+	f.last_ts = g->ts;
+
+	/* Micro-units, the direction vectors are normalized anyway */
+	mahony(g->gyro[0] / 1e6f, g->gyro[1] / 1e6f, g->gyro[2] / 1e6f,
+		(float)a->accel[0], (float)a->accel[1], (float)a->accel[2],
+		(float)a->magn[0], (float)a->magn[1], (float)a->magn[2], dt);
+
+	out->q[0] = to_q14(f.q0);
+	out->q[1] = to_q14(f.q1);
+	out->q[2] = to_q14(f.q2);
+	out->q[3] = to_q14(f.q3);
+	out->ts = g->ts;
+}
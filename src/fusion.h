@@ -0,0 +1,27 @@
+#pragma once
+#include "common.h"
+
+/*
+ * Orientation fusion
+ *
+ * Mahony complementary filter: the gyro rate is integrated into a
+ * quaternion, and the drift is corrected towards gravity (accel) and
+ * magnetic north (magn) with a PI controller on the error between the
+ * measured and the estimated directions. Without magnetometer data
+ * (all 0) yaw is gyro only.
+ *
+ * Runs in single precision floating point, on the FPU where there is
+ * one (Cortex-M4F). Updated once per published gyro sample with the
+ * latest accel/magn sample, the time step is taken from the gyro
+ * timestamps.
+ */
+
+/* Reset to identity */
+void fusion_init(void);
+
+/* Update with a new gyro sample and the latest accel/magn sample, and
+ * write the new orientation, stamped with the gyro sample's time. Must
+ * only be called from one thread.
+ */
+void fusion_update(const struct gyro_sample *g, const struct accel_sample *a,
+		struct quat_sample *out);
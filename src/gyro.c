@@ -1,21 +1,259 @@
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/byteorder.h>
 #include <stdio.h>
 #include "common.h"
+#include "clock.h"
+#include "capture.h"
+#include "latency.h"
+#include "fifo.h"
+#include "acq_rtio.h"
+#ifdef CONFIG_SYNTH_IMU
+#include "synth_imu.h"
+#endif
 
 static struct avb_sensor_data *_data = NULL;
 static const struct device * dev_g = NULL;
 static bool valid = false;
 
 K_SEM_DEFINE(sem_g, 0, 1);	/* starts off "not available" */
+
+/* The FXAS21002 rate is fixed at build time. Tx interval, ring size,
+ * timestamps and fusion all go by AVB_GYRO_ODR_HZ, which sets
+ * FXAS21002_DR by default, so refuse a build where they differ.
+ */
+#if DT_NODE_HAS_COMPAT(AVB_GYRO_NODE, nxp_fxas21002) && defined(CONFIG_FXAS21002_DR)
+BUILD_ASSERT((800 >> CONFIG_FXAS21002_DR) == CONFIG_AVB_GYRO_ODR_HZ,
+	"CONFIG_FXAS21002_DR does not match CONFIG_AVB_GYRO_ODR_HZ");
+#endif
+
+/* FIFO burst reads on the real part, or on the FIFO emulation of the
+ * synthetic IMU
+ */
+#ifdef CONFIG_AVB_SENSOR_FIFO
+#if DT_NODE_HAS_COMPAT(AVB_GYRO_NODE, nxp_fxas21002)
+#define GYRO_FIFO 1
+#elif DT_NODE_HAS_COMPAT(AVB_GYRO_NODE, avb_synth_imu)
+#define GYRO_FIFO 1
+#define GYRO_FIFO_SYNTH 1
+#endif
+#endif
+
+/* Data-ready interrupt pin, the same one the driver uses */
+#ifdef CONFIG_FXAS21002_DRDY_INT1
+#define GYRO_INT int1_gpios
+#else
+#define GYRO_INT int2_gpios
+#endif
+#if DT_NODE_HAS_PROP(AVB_GYRO_NODE, GYRO_INT)
+static const struct gpio_dt_spec gyro_int = GPIO_DT_SPEC_GET(AVB_GYRO_NODE, GYRO_INT);
+#define GYRO_INT_PIN (&gyro_int)
+#else
+#define GYRO_INT_PIN NULL
+#endif
+
+static struct capture_ts cap_g;
+
+/* Capture time (cycles) of the sample behind sem_g, written by the
+ * trigger while the collector may still be reading the previous one.
+ */
+static atomic_t capture_cyc_g;
+
+/* Time from capture to the collector running, i.e. what used to be
+ * included in the timestamp
+ */
+static inline void capture_delay(uint32_t cyc)
+{
+	latency_add_cyc(LAT_GYRO_COLLECT, cyc);
+}
+
+#ifdef GYRO_FIFO
+static struct fifo_burst fifo_g;
+static bool fifo_mode = false;
+#endif
+
+#ifdef GYRO_FIFO_SYNTH
+#define GYRO_REC_SZ		SYNTH_IMU_FIFO_REC_SZ
+
+/* Records are micro-units already */
+static inline int64_t gyro_fifo_decode(const uint8_t *r, int ax)
+{
+	return (int32_t)sys_get_be32(&r[4 * ax]);
+}
+
+/* Watermark trigger, called from the synthetic IMU's timer ISR */
+static void th_gyro_wm(const struct device *dev,
+		const struct sensor_trigger *trigger)
+{
+	capture_ts_edge(&cap_g);
+}
+
+static int gyro_fifo_init(void)
+{
+	static const struct sensor_trigger trig = {
+		.type = SENSOR_TRIG_FIFO_WATERMARK,
+		.chan = SENSOR_CHAN_GYRO_XYZ,
+	};
+	int ret;
+
+	ret = fifo_burst_init_synth(&fifo_g, dev_g, CONFIG_AVB_SENSOR_FIFO_WATERMARK,
+				CONFIG_AVB_GYRO_ODR_HZ * 1000);
+	if (ret)
+		return ret;
+
+	capture_ts_init_edge(&cap_g);
+	capture_ts_notify(&cap_g, &sem_g);
+	ret = sensor_trigger_set(dev_g, &trig, th_gyro_wm);
+	if (!ret)
+		ret = synth_imu_fifo_enable(dev_g, SENSOR_CHAN_GYRO_XYZ, CONFIG_AVB_SENSOR_FIFO_WATERMARK);
+	if (ret) {
+		capture_ts_notify(&cap_g, NULL);
+		return ret;
+	}
+
+	fifo_mode = true;
+	return 0;
+}
+#elif defined(GYRO_FIFO)
+/* FXAS21002 registers, bypassing the driver in FIFO mode */
+#define FXAS_REG_OUT_X_MSB	0x01
+#define FXAS_REG_F_STATUS	0x08
+#define FXAS_REG_F_SETUP	0x09
+#define FXAS_REG_CTRL0		0x0d
+#define FXAS_REG_CTRL1		0x13
+#define FXAS_REG_CTRL2		0x14
+#define FXAS_REG_CTRL3		0x15
+
+#define FXAS_F_MODE_CIRCULAR	(1 << 6)
+#define FXAS_CTRL0_FS_MASK	0x03
+#define FXAS_CTRL1_MODE_MASK	0x03	/* READY | ACTIVE */
+#define FXAS_CTRL1_DR_SHIFT	2
+#define FXAS_CTRL1_DR_MASK	0x1c
+#define FXAS_CTRL2_INT_CFG_FIFO	BIT(7)	/* route to INT1 */
+#define FXAS_CTRL2_INT_EN_FIFO	BIT(6)
+#define FXAS_CTRL2_INT_EN_DRDY	BIT(2)
+#define FXAS_CTRL3_WRAPTOONE	BIT(3)	/* burst wraps from Z LSB to X MSB */
+
+#define FXAS_REC_SZ		6
+#define GYRO_REC_SZ		FXAS_REC_SZ
+
+static const uint32_t fxas_odr_mhz[] = {
+	800000, 400000, 200000, 100000, 50000, 25000, 12500, 12500
+};
+
+static const struct i2c_dt_spec gyro_i2c = I2C_DT_SPEC_GET(AVB_GYRO_NODE);
+
+/* 62.5 mdps/LSB at 2000 dps, halved for every step down in range */
+static int gyro_fs;
+
+static inline int64_t fxas_to_urad(int16_t raw)
+{
+	return (int64_t)raw * 62500 * SENSOR_PI / (180LL * 1000000LL << gyro_fs);
+}
+
+static inline int64_t gyro_fifo_decode(const uint8_t *r, int ax)
+{
+	return fxas_to_urad((int16_t)sys_get_be16(&r[2 * ax]));
+}
+
+/* Switch the gyro to FIFO mode with a watermark interrupt on the pin
+ * the driver uses for data-ready. The driver's DRDY interrupt is
+ * disabled, its trigger is not used at all.
+ */
+static int gyro_fifo_init(void)
+{
+	uint8_t ctrl0, ctrl1;
+	int ret;
+
+	if (!device_is_ready(gyro_i2c.bus))
+		return -ENODEV;
+
+	ret = i2c_reg_read_byte_dt(&gyro_i2c, FXAS_REG_CTRL0, &ctrl0);
+	if (!ret)
+		ret = i2c_reg_read_byte_dt(&gyro_i2c, FXAS_REG_CTRL1, &ctrl1);
+	if (ret)
+		return ret;
+
+	gyro_fs = ctrl0 & FXAS_CTRL0_FS_MASK;
+	ret = fifo_burst_init(&fifo_g, &gyro_i2c, FXAS_REG_F_STATUS, FXAS_REG_OUT_X_MSB,
+			FXAS_REC_SZ, CONFIG_AVB_SENSOR_FIFO_WATERMARK,
+			fxas_odr_mhz[(ctrl1 & FXAS_CTRL1_DR_MASK) >> FXAS_CTRL1_DR_SHIFT]);
+	if (ret)
+		return ret;
+
+	capture_ts_notify(&cap_g, &sem_g);
+
+	/* FIFO setup only in standby */
+	uint8_t int_cfg = IS_ENABLED(CONFIG_FXAS21002_DRDY_INT1) ? FXAS_CTRL2_INT_CFG_FIFO : 0;
+	ret = i2c_reg_write_byte_dt(&gyro_i2c, FXAS_REG_CTRL1, ctrl1 & ~FXAS_CTRL1_MODE_MASK);
+	if (!ret)
+		ret = i2c_reg_update_byte_dt(&gyro_i2c, FXAS_REG_CTRL3,
+					FXAS_CTRL3_WRAPTOONE, FXAS_CTRL3_WRAPTOONE);
+	if (!ret)
+		ret = i2c_reg_write_byte_dt(&gyro_i2c, FXAS_REG_F_SETUP,
+					FXAS_F_MODE_CIRCULAR | CONFIG_AVB_SENSOR_FIFO_WATERMARK);
+	if (!ret)
+		ret = i2c_reg_update_byte_dt(&gyro_i2c, FXAS_REG_CTRL2,
+					FXAS_CTRL2_INT_CFG_FIFO | FXAS_CTRL2_INT_EN_FIFO | FXAS_CTRL2_INT_EN_DRDY,
+					int_cfg | FXAS_CTRL2_INT_EN_FIFO);
+	if (!ret)
+		ret = i2c_reg_write_byte_dt(&gyro_i2c, FXAS_REG_CTRL1, ctrl1);
+	if (ret) {
+		capture_ts_notify(&cap_g, NULL);
+		return ret;
+	}
+
+	fifo_mode = true;
+	return 0;
+}
+#endif
+
+#ifdef GYRO_FIFO
+/* One watermark interrupt (or timeout), one burst */
+static void gyro_fifo_collect(void)
+{
+	uint8_t raw[FIFO_MAX_RECORDS * GYRO_REC_SZ];
+	struct gyro_sample s;
+
+	bool irq = k_sem_take(&sem_g, fifo_burst_timeout(&fifo_g)) == 0;
+	uint32_t irq_cyc = capture_ts_take(&cap_g);
+
+	int n = fifo_burst_read(&fifo_g, irq, irq_cyc, raw);
+	if (n < 0) {
+		printf("[GYRO] FIFO read FAILED (%d)\n", n);
+		return;
+	}
+	if (irq)
+		capture_delay(irq_cyc);
+
+	for (int i = 0; i < n; i++) {
+		const uint8_t *r = &raw[i * GYRO_REC_SZ];
+
+		s.ts = clock_cyc32_to_ns(fifo_burst_ts(&fifo_g, i));
+		for (int ax = 0; ax < 3; ax++)
+			s.gyro[ax] = gyro_fifo_decode(r, ax);
+		data_publish_gyro(_data, &s);
+		_data->gyro_ctr++;
+	}
+}
+#endif /* GYRO_FIFO */
+
 static void th_gyro(const struct device *dev,
 		const struct sensor_trigger *trigger)
 {
+	uint32_t cyc = capture_ts_take(&cap_g);
+
+#ifdef CONFIG_AVB_RTIO
+	/* Read, decode and publish asynchronously, see acq_rtio.h */
+	acq_rtio_submit(ACQ_GYRO, cyc);
+#else
 	if (sensor_sample_fetch(dev)) {
 		printf("[GYRO] sensor_sample_fetch() FAILED\n");
 		return;
 	}
+	atomic_set(&capture_cyc_g, (atomic_val_t)cyc);
 	k_sem_give(&sem_g);
+#endif
 }
 
 
@@ -26,12 +264,45 @@ int gyro_init(struct avb_sensor_data *sensor_data)
 
 	_data = sensor_data;
 
-	dev_g = DEVICE_DT_GET_ANY(nxp_fxas21002);
-	if (dev_g == NULL || !device_is_ready(dev_g)) {
+	dev_g = DEVICE_DT_GET_OR_NULL(AVB_GYRO_NODE);
+	if (dev_g == NULL) {
+		printf("No gyro device in devicetree.\n");
+		return -1;
+	}
+	if (!device_is_ready(dev_g)) {
 		printf("Device %s is not ready.\n", dev_g->name);
 		return -1;
 	}
 
+	/* Not all drivers take the rate at runtime (FXAS21002 has it in
+	 * Kconfig, CONFIG_FXAS21002_DR, checked against ours above).
+	 */
+	struct sensor_value attr_g = {
+		.val1 = CONFIG_AVB_GYRO_ODR_HZ,
+		.val2 = 0,
+	};
+	if (sensor_attr_set(dev_g, SENSOR_CHAN_ALL,
+				SENSOR_ATTR_SAMPLING_FREQUENCY, &attr_g))
+		printf("Could not set sampling frequency for %s, using driver default\n", dev_g->name);
+
+	if (capture_ts_init(&cap_g, GYRO_INT_PIN))
+		printf("Could not timestamp %s interrupt, using trigger.\n", dev_g->name);
+
+#ifdef GYRO_FIFO
+	if (!IS_ENABLED(GYRO_FIFO_SYNTH) && !cap_g.irq) {
+		printf("No interrupt timestamps for %s, FIFO disabled.\n", dev_g->name);
+	} else if (gyro_fifo_init()) {
+		printf("Could not set up FIFO for %s, using trigger.\n", dev_g->name);
+	} else {
+		capture_ts_period(&cap_g, CONFIG_AVB_GYRO_ODR_HZ, CONFIG_AVB_SENSOR_FIFO_WATERMARK);
+		printf("Device %s is ready, FIFO watermark %d.\n",
+			dev_g->name, CONFIG_AVB_SENSOR_FIFO_WATERMARK);
+		valid = true;
+		return 0;
+	}
+#endif
+
+	capture_ts_period(&cap_g, CONFIG_AVB_GYRO_ODR_HZ, 1);
 	struct sensor_trigger trig_g = {
 		.type = SENSOR_TRIG_DATA_READY,
 		.chan = SENSOR_CHAN_GYRO_XYZ,
@@ -55,14 +326,28 @@ void gyro_collector(void)
 	} while (!valid);
 
 	while (valid && data_valid(_data)) {
+		struct gyro_sample s;
+
+#ifdef GYRO_FIFO
+		if (fifo_mode) {
+			gyro_fifo_collect();
+			continue;
+		}
+#endif
 		k_sem_take(&sem_g, K_FOREVER);
-		uint64_t ts = gptp_ts();
+		uint32_t cyc = (uint32_t)atomic_get(&capture_cyc_g);
+
+		s.ts = clock_cyc32_to_ns(cyc);
+		capture_delay(cyc);
+
+		/* Convert here, once, rather than in the Tx path */
+		struct sensor_value v[3];
 
-		data_get(_data);
-		sensor_channel_get(dev_g, SENSOR_CHAN_GYRO_XYZ, &_data->gyro[0]);
-		_data->gyro_ts = ts;
+		sensor_channel_get(dev_g, SENSOR_CHAN_GYRO_XYZ, v);
+		for (int i = 0; i < 3; i++)
+			s.gyro[i] = sensor_value_to_micro(&v[i]);
+		data_publish_gyro(_data, &s);
 		_data->gyro_ctr++;
-		data_put(_data);
 	}
 	printf("[GYRO] Closing down gyro-collector.\n");
 }
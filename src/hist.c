@@ -0,0 +1,71 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "hist.h"
+
+void hist_reset(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min_ns = UINT32_MAX;
+}
+
+void hist_add(struct hist *h, uint32_t ns)
+{
+	uint32_t us = ns / 1000;
+	int b = 0;
+
+	while (us && b < HIST_BUCKETS - 1) {
+		us >>= 1;
+		b++;
+	}
+	h->bucket[b]++;
+	h->n++;
+	h->sum_ns += ns;
+	h->min_ns = MIN(h->min_ns, ns);
+	h->max_ns = MAX(h->max_ns, ns);
+}
+
+uint32_t hist_percentile(const struct hist *h, int permille)
+{
+	uint64_t want = ((uint64_t)h->n * permille + 999) / 1000;
+	uint64_t seen = 0;
+
+	if (!h->n)
+		return 0;
+
+	for (int b = 0; b < HIST_BUCKETS - 1; b++) {
+		seen += h->bucket[b];
+		if (seen >= want)
+			return MIN((1u << b) * 1000, h->max_ns);
+	}
+	return h->max_ns;
+}
+
+void hist_format(const struct hist *h, const char *name, hist_line_fn line, void *ctx)
+{
+	char buf[128];
+
+	if (!h->n) {
+		snprintf(buf, sizeof(buf), "%s: no samples", name);
+		line(ctx, buf);
+		return;
+	}
+
+	snprintf(buf, sizeof(buf), "%s: n=%u min=%u avg=%u p99<=%u p99.9<=%u max=%u ns",
+		name, h->n, h->min_ns, (uint32_t)(h->sum_ns / h->n),
+		hist_percentile(h, 990), hist_percentile(h, 999), h->max_ns);
+	line(ctx, buf);
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		if (!h->bucket[b])
+			continue;
+		if (b == 0)
+			snprintf(buf, sizeof(buf), "  %6s < %6u us: %u", "", 1, h->bucket[b]);
+		else if (b == HIST_BUCKETS - 1)
+			snprintf(buf, sizeof(buf), "  %6u+         us: %u", 1u << (b - 1), h->bucket[b]);
+		else
+			snprintf(buf, sizeof(buf), "  %6u - %6u us: %u", 1u << (b - 1), 1u << b, h->bucket[b]);
+		line(ctx, buf);
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * Latency histogram with log2 buckets
+ *
+ * Bucket 0 counts values below 1 us, bucket i values in
+ * [2^(i-1), 2^i) us, the last bucket everything above.
+ */
+#define HIST_BUCKETS	16
+
+struct hist {
+	uint32_t bucket[HIST_BUCKETS];
+	uint32_t n;
+	uint32_t min_ns;
+	uint32_t max_ns;
+	uint64_t sum_ns;
+};
+
+void hist_reset(struct hist *h);
+void hist_add(struct hist *h, uint32_t ns);
+
+/* Upper bound (ns) of the bucket holding the given percentile, in per
+ * mille (990 for p99), capped to the max. 0 without samples.
+ */
+uint32_t hist_percentile(const struct hist *h, int permille);
+
+/* Called with each line of hist_format(), without newline */
+typedef void (*hist_line_fn)(void *ctx, const char *line);
+
+/* Format count/min/avg/p99/p99.9/max and the non-empty buckets, one
+ * line at a time, for whatever console the caller prints to.
+ */
+void hist_format(const struct hist *h, const char *name, hist_line_fn line, void *ctx);
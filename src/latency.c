@@ -0,0 +1,58 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#include <string.h>
+
+#include "latency.h"
+
+static const char *const stage_names[LAT_NUM_STAGES] = {
+	[LAT_GYRO_COLLECT]  = "gyro irq->collector",
+	[LAT_ACCEL_COLLECT] = "accel irq->collector",
+	[LAT_SAMPLE_AGE]    = "capture->pdu_add_data",
+	[LAT_PDU_BUILD]     = "pdu_add_data",
+	[LAT_CREDIT_WAIT]   = "cbs credit wait",
+	[LAT_TX_DONE]       = "send->tx done",
+};
+
+static struct hist hists[LAT_NUM_STAGES];
+
+/* Serialises writers, LAT_TX_DONE is added from every Tx thread (and
+ * buffer release), and keeps copies consistent.
+ */
+static struct k_spinlock lock;
+
+/* Bit per stage, set by latency_reset() and cleared by the writer.
+ * Starts out set, so every histogram is reset before its first sample.
+ */
+static atomic_t reset_req = ATOMIC_INIT(BIT_MASK(LAT_NUM_STAGES));
+
+void latency_add(enum lat_stage st, uint32_t ns)
+{
+	struct hist *h = &hists[st];
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	if (atomic_test_and_clear_bit(&reset_req, st))
+		hist_reset(h);
+	hist_add(h, ns);
+	k_spin_unlock(&lock, key);
+}
+
+void latency_get(enum lat_stage st, struct hist *h)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	if (atomic_test_bit(&reset_req, st))
+		hist_reset(h);
+	else
+		memcpy(h, &hists[st], sizeof(*h));
+	k_spin_unlock(&lock, key);
+}
+
+void latency_reset(void)
+{
+	atomic_set(&reset_req, BIT_MASK(LAT_NUM_STAGES));
+}
+
+const char *latency_name(enum lat_stage st)
+{
+	return st < LAT_NUM_STAGES ? stage_names[st] : "?";
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <zephyr/kernel.h>
+#include "hist.h"
+
+/*
+ * Per-stage pipeline latency
+ *
+ * One histogram (hist.h) per stage between data-ready and the wire,
+ * dumped and reset with the "avb latency" shell command. Adding takes
+ * a spinlock, a stage can have several writers (Tx completions run on
+ * every traffic class Tx thread). A reset is only requested by the
+ * shell and carried out on the next sample.
+ *
+ * Without CONFIG_AVB_LATENCY_STATS the hooks compile to nothing.
+ */
+enum lat_stage {
+	LAT_GYRO_COLLECT,	/* gyro data-ready -> collector */
+	LAT_ACCEL_COLLECT,	/* accel data-ready -> collector */
+	LAT_SAMPLE_AGE,		/* capture -> pdu_add_data(), oldest sample in frame */
+	LAT_PDU_BUILD,		/* time spent in pdu_add_data() */
+	LAT_CREDIT_WAIT,	/* frame pending -> CBS credit granted */
+	LAT_TX_DONE,		/* frame handed to the stack -> Tx completed */
+	LAT_NUM_STAGES,
+};
+
+#ifdef CONFIG_AVB_LATENCY_STATS
+void latency_add(enum lat_stage st, uint32_t ns);
+
+/* Add the time since start_cyc (k_cycle_get_32()) */
+static inline void latency_add_cyc(enum lat_stage st, uint32_t start_cyc)
+{
+	latency_add(st, k_cyc_to_ns_floor32(k_cycle_get_32() - start_cyc));
+}
+
+/* Consistent copy of the histogram of a stage */
+void latency_get(enum lat_stage st, struct hist *h);
+
+/* Request all histograms to be cleared */
+void latency_reset(void);
+
+const char *latency_name(enum lat_stage st);
+#else
+static inline void latency_add(enum lat_stage st, uint32_t ns) {}
+static inline void latency_add_cyc(enum lat_stage st, uint32_t start_cyc) {}
+#endif
@@ -2,11 +2,18 @@
 #include <stdio.h>
 #include <zephyr/drivers/sensor.h>
 #include "common.h"
+#include "clock.h"
+#include "acq_rtio.h"
 
 int main(void)
 {
 	bool startup_err = false;
 
+#ifdef CONFIG_AVB_BENCH
+	/* Before anything else is running */
+	bench_run();
+#endif
+
 	/* Setup Time first */
 	gptp_init();
 
@@ -20,6 +27,14 @@ int main(void)
 	data->running = true;
 	data->ready = false;
 
+#ifdef CONFIG_AVB_RTIO
+	/* Before the triggers start submitting reads */
+	if (acq_rtio_init(data) != 0) {
+		printf("Failed starting RTIO acquisition!\n");
+		startup_err = true;
+	}
+#endif
+
 	/* ------------------------------------------------------
 	 * FXAS21002 - Gyro
 	 * Collector runs in own thread waiting for gyro_init() to be called
@@ -41,12 +56,39 @@ int main(void)
 	/* ------------------------------------------------------
 	 * network setup, making addresses, buffers, CBS etc ready
 	 *
-	 * accel reads data at 100Hz (10ms)
+	 * Tx intervals follow from the sensor ODRs unless set with
+	 * CONFIG_AVB_TX_INTERVAL_US, see common.h
 	 */
-	if (network_init(data, 10*NSEC_PER_MSEC, CLASS_NONE) != 0) {
+	if (network_init(data, IS_ENABLED(CONFIG_AVB_TAS) ? AVB_SHAPER_TAS : AVB_SHAPER_CBS) != 0) {
 		printf("Failed starting network\n");
 		startup_err = true;
 	}
+#ifdef CONFIG_AVB_FUSION_ONLY
+	/* Orientation in place of the raw samples */
+	else if (network_add_stream(AVB_SENSOR_QUAT, AVB_QUAT_TX_INTERVAL_NS, AVB_STREAM_CLASS) < 0) {
+		printf("Failed adding orientation stream\n");
+		startup_err = true;
+	}
+#elif defined(CONFIG_AVB_SPLIT_STREAMS)
+	/* Gyro at Class A, the slower accel/magn/temp at Class B */
+	else if (network_add_stream(AVB_SENSOR_GYRO, AVB_GYRO_TX_INTERVAL_NS, CLASS_A) < 0 ||
+		network_add_stream(AVB_SENSOR_ACCEL, AVB_ACCEL_TX_INTERVAL_NS, CLASS_B) < 0) {
+		printf("Failed adding sensor streams\n");
+		startup_err = true;
+	}
+#else
+	else if (network_add_stream(AVB_SENSOR_ALL, AVB_GYRO_TX_INTERVAL_NS, AVB_STREAM_CLASS) < 0) {
+		printf("Failed adding sensor stream\n");
+		startup_err = true;
+	}
+#endif
+#ifdef CONFIG_AVB_FUSION_ALONGSIDE
+	if (!startup_err &&
+		network_add_stream(AVB_SENSOR_QUAT, AVB_QUAT_TX_INTERVAL_NS, AVB_STREAM_CLASS) < 0) {
+		printf("Failed adding orientation stream\n");
+		startup_err = true;
+	}
+#endif
 
 	if (startup_err) {
 		printf("Startup errors exists, aborting..\n");
@@ -66,37 +108,40 @@ int main(void)
 
 /* To enable this, call west with: -DEXTRA_CFLAGS="-DDEBUG=1" */
 #ifdef DEBUG
-		if (data_get(data) == 0) {
-			double diff_ms = (int64_t)(data->accel_ts - data->gyro_ts) / 1e6;
-			printf("[%"PRIu64"] (%8.3f ms) ", data->gyro_ts, diff_ms);
-
-			printf("GX=%10.3f GY=%10.3f GZ=%10.3f ",
-				sensor_value_to_double(&data->gyro[0]),
-				sensor_value_to_double(&data->gyro[1]),
-				sensor_value_to_double(&data->gyro[2]));
-
-			printf("AX=%10.6f AY=%10.6f AZ=%10.6f ",
-				sensor_value_to_double(&data->accel[0]),
-				sensor_value_to_double(&data->accel[1]),
-				sensor_value_to_double(&data->accel[2]));
-
-			/* Print mag x,y,z data */
-			printf("MX=%10.6f MY=%10.6f MZ=%10.6f ",
-				sensor_value_to_double(&data->magn[0]),
-				sensor_value_to_double(&data->magn[1]),
-				sensor_value_to_double(&data->magn[2]));
-
-			/* Print accel x,y,z and mag x,y,z data */
-			printf("T=%10.6f", sensor_value_to_double(&data->temp));
-			printf("\n");
-			data_put(data);
-		}
+		struct gyro_sample gs;
+		struct accel_sample as;
+
+		data_snapshot_gyro(data, &gs);
+		data_snapshot_accel(data, &as);
+
+		double diff_ms = (int64_t)(as.ts - gs.ts) / 1e6;
+		printf("[%"PRIu64"] (%8.3f ms) ", gs.ts, diff_ms);
+
+		/* Samples are in micro-units */
+		printf("GX=%10.3f GY=%10.3f GZ=%10.3f ",
+			gs.gyro[0] / 1e6, gs.gyro[1] / 1e6, gs.gyro[2] / 1e6);
+
+		printf("AX=%10.6f AY=%10.6f AZ=%10.6f ",
+			as.accel[0] / 1e6, as.accel[1] / 1e6, as.accel[2] / 1e6);
+
+		/* Print mag x,y,z data */
+		printf("MX=%10.6f MY=%10.6f MZ=%10.6f ",
+			as.magn[0] / 1e6, as.magn[1] / 1e6, as.magn[2] / 1e6);
+
+		/* Print accel x,y,z and mag x,y,z data */
+		printf("T=%10.6f", as.temp / 1e6);
+		printf("\n");
 #endif /* DEBUG */
 	}
 	return 0;
 }
 
+K_THREAD_DEFINE(CLOCK_SERVICE,   1024, clock_service     , NULL, NULL, NULL, 0, 0, 0);
+#ifdef CONFIG_AVB_RTIO
+K_THREAD_DEFINE(SENSOR_RTIO,     1024, acq_rtio_process  , NULL, NULL, NULL, 2, 0, 0);
+#else
 K_THREAD_DEFINE(GYRO_COLLECTOR,  1024, gyro_collector    , NULL, NULL, NULL, 3, 0, 0);
 K_THREAD_DEFINE(ACCEL_COLLECTOR, 1024, accel_collector   , NULL, NULL, NULL, 2, 0, 0);
+#endif
 K_THREAD_DEFINE(NETWORK_SENDER,  1024, network_sender    , NULL, NULL, NULL, 1, 0, 0);
-K_THREAD_DEFINE(CBS_REFILLER,    2048, network_cbs_refill, NULL, NULL, NULL, 0, 0, 0);
+K_THREAD_DEFINE(RX_DRAIN,         512, network_rx_drain  , NULL, NULL, NULL, K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
@@ -5,10 +5,20 @@
 #include <zephyr/net/net_core.h>
 #include <zephyr/net/net_l2.h>
 #include <zephyr/net/net_if.h>
+#include <zephyr/net/net_pkt.h>
+#include <zephyr/net/net_pkt_filter.h>
+#include <zephyr/net/buf.h>
+#include <zephyr/sys/byteorder.h>
 #include "avtp.h"
 #include "avtp_stream.h"
+#include "payload.h"
+#include "cbs.h"
+#include "clock.h"
+#include "latency.h"
 
 #include <stdio.h>		/* printf() */
+#include <errno.h>
+
 #define PREAMBLE_SZ		7
 #define SFD_SZ			1
 #define CRC_SZ			4
@@ -16,49 +26,116 @@
 #define L1_SZ			(PREAMBLE_SZ + SFD_SZ + CRC_SZ + IPG_SZ)
 #define L2_SZ			14
 #define VLAN_SZ			 4
-#define DATA_LEN		sizeof(struct sensor_set)
-#define PDU_SIZE		(sizeof(struct avtp_stream_pdu) + DATA_LEN)
+#define PDU_BUF_SZ		NET_ETH_MTU
+#define ETH_HDR_MAX		(L2_SZ + VLAN_SZ)
 #define STREAM_ID		42
+#define AVB_ETH_TYPE		0x22f0
 
-struct net_info {
-	/* iface related fields
-	 */
-	int max_mtu;
-	int queue;
+/* Destination for the sensor stream */
+static const uint8_t ether_mcast_addr[] = {0x01, 0x00, 0x5E, 0x01, 0x11, 0x42};
 
+struct avb_stream {
 	/* Complete streamid, including host MAC address */
 	union {
 		uint64_t u64;
 		unsigned char u8[8];
 	} stream_id;
+	uint8_t dst_addr[sizeof(ether_mcast_addr)];
 
 	/* CB Settings */
 	enum avb_stream_class sc;
-	uint64_t portTxRate;
 
 	/* Refill-rate, bits/sec */
 	int64_t idleSlope;
 
-	/* timer period for refill task */
-	int64_t idleSlope_period_ns;
-	int idleSlope_rate;
-	int idleSlope_refill;
-
-	/* each timer period refill amount */
-	int64_t idleSlope_period;
-
 	int64_t sendSlope;
 
 	/* Credits (in bits) */
-	int credit;
+	struct cbs cbs;
 	int maxFrameSize;
 	int loCredit;
 	int hiCredit;
 	uint64_t tx_interval_ns;
 
+	/* Payload format, samples per frame and resulting max payload */
+	struct payload_fmt fmt;
+	int payload_sz;
+
+	/* Everything but seq_num, time and length is fixed once added */
+	struct avtp_stream_tmpl tmpl;
+	uint8_t seq_num;
 
 	/* Tx Priority */
 	struct net_context *avb_ctx;
+	uint8_t prio;
+
+	/* Frame handed to avb_ctx whose credit the Tx callback has not
+	 * charged yet, the sender holds the stream back until it has.
+	 * in_flight_bits is its size on the wire, see tx_bits(). There is
+	 * never more than one, so it has a single hand-over time.
+	 */
+	atomic_t in_flight;
+	int in_flight_bits;
+#ifdef CONFIG_AVB_LATENCY_STATS
+	uint32_t tx_sent_cyc;
+#endif
+
+	/* Pre-built Ethernet (+VLAN) header for the zero-copy Tx path */
+	uint8_t eth_hdr[ETH_HDR_MAX];
+	int eth_hdr_len;
+
+#ifdef CONFIG_AVB_TAS
+	/* Gate control: window opens at gate_offset_ns + n*gate_period_ns
+	 * (gPTP time), gate_last is the last window used.
+	 */
+	uint64_t gate_offset_ns;
+	uint64_t gate_period_ns;
+	uint64_t gate_last;
+	uint32_t gate_missed;
+#endif
+#ifdef CONFIG_AVB_LAUNCH_ALIGN
+	/* Slot of the frame holding credit, 0 until it has credit */
+	uint64_t launch_ns;
+#endif
+
+#if defined(CONFIG_AVB_LATENCY_STATS) || defined(CONFIG_AVB_STATS)
+	/* Since when the pending frame waits for credit, see cbs_sender() */
+	bool credit_waiting;
+	uint32_t credit_wait_cyc;
+#endif
+
+#ifdef CONFIG_AVB_STATS
+	/* Counters only written by the sender, see network_stream_stats() */
+	struct avb_stream_stats stats;
+	uint64_t stats_since_ns;
+	uint32_t ring_dropped_base;
+#endif
+};
+
+struct net_info {
+	/* iface related fields
+	 */
+	int max_mtu;
+	uint64_t portTxRate;
+	struct net_if *iface;
+	bool vlan_enabled;
+
+	/* How streams are shaped, see network_init() */
+	enum avb_shaper shaper;
+
+	/* MAC holds frames until net_pkt txtime (ETHERNET_TXTIME) */
+	bool txtime;
+
+	/* Tx for CLASS_NONE, Rx of looped back frames in network_rx_drain() */
+	int avb_socket;
+
+	/* Outgoing streams, in the order they were added */
+	struct avb_stream streams[CONFIG_AVB_MAX_STREAMS];
+	int n_streams;
+
+	/* Same streams, in strict priority order (Class A first) */
+	struct avb_stream *sched[CONFIG_AVB_MAX_STREAMS];
+
 	/*
 	 * Reference to sensor data. The collector-threads will feed data into
 	 * this whenever their sensor is ready. When we can transmit, we reserve
@@ -68,210 +145,263 @@ struct net_info {
 };
 static struct net_info ninfo = {0};
 
+#ifdef CONFIG_AVB_STATS
+#define STREAM_STAT_ADD(s, field, v)	((s)->stats.field += (v))
 
-/* cbs_can_tx
- * We use this to signal that credits are available.
- *
- * Upper limit is 1, i.e. we can give this semaphore as many times as we
- * like, but we will never have a queue of 'unused locks' which could
- * lead to a massive overspending of credits.
- */
-K_SEM_DEFINE(cbs_can_tx, 0, 1);
+/* Set by network_stats_reset(), cleared by the sender */
+static atomic_t stats_reset_req;
+#else
+#define STREAM_STAT_ADD(s, field, v)	do { } while (0)
+#endif
 
-/* change this to mutex? */
-K_SEM_DEFINE(cbs_credit_lock, 1, 1);
 
-/* Worker that periodically refills the credits. Once credits reaches >=
- * 0, potential waiters are signalled.
- */
+/* Frame size on the wire, incl. L1 overhead, in bits */
+#define TX_BITS(payload_sz)	(((payload_sz) + sizeof(struct avtp_stream_pdu) + L1_SZ + L2_SZ + VLAN_SZ) * 8)
 
-/* CBS refill signal */
-K_SEM_DEFINE(cbs_timer_sem,0,1);
-static struct k_timer cbs_timer;
-void cbs_timeout(struct k_timer *timer_id) {
-	k_sem_give(&cbs_timer_sem);
+static inline int tx_bits(int payload_sz)
+{
+	return TX_BITS(payload_sz);
 }
 
-/* Dedicated worker that periodically refills the Tx-credit.
- *
- * As we do not have HW assisted CBS, this this is done in SW and to
- * reduce the overhead, the interval is higher than the observation
- * interval for both class A and B.
- *
+/* Build time check of the streams main() adds, at full batches.
+ * 802.1Qav lets the SR classes reserve at most 75% of the link.
  */
-void network_cbs_refill(void)
+#define STREAM_BPS(g, a, interval_ns)						\
+	((uint64_t)TX_BITS(MIN(PAYLOAD_SIZE_BOUND(g, a),			\
+			PDU_BUF_SZ - sizeof(struct avtp_stream_pdu))) * NSEC_PER_SEC / (interval_ns))
+#define QUAT_BPS							\
+	((uint64_t)TX_BITS(QUAT_PAYLOAD_SIZE_BOUND) * NSEC_PER_SEC / AVB_QUAT_TX_INTERVAL_NS)
+#if defined(CONFIG_AVB_FUSION_ONLY)
+#define CONFIGURED_BPS	QUAT_BPS
+#elif defined(CONFIG_AVB_SPLIT_STREAMS)
+#define CONFIGURED_BPS	(STREAM_BPS(1, 0, AVB_GYRO_TX_INTERVAL_NS) +		\
+			STREAM_BPS(0, 1, AVB_ACCEL_TX_INTERVAL_NS))
+#else
+#define CONFIGURED_BPS	STREAM_BPS(1, 1, AVB_GYRO_TX_INTERVAL_NS)
+#endif
+#ifdef CONFIG_AVB_FUSION_ALONGSIDE
+BUILD_ASSERT(CONFIGURED_BPS + QUAT_BPS <= (uint64_t)CONFIG_AVB_LINK_MBPS * 1000000 * 3 / 4,
+	"Sensor and orientation streams exceed 75% of AVB_LINK_MBPS");
+#endif
+BUILD_ASSERT(CONFIGURED_BPS <= (uint64_t)CONFIG_AVB_LINK_MBPS * 1000000 * 3 / 4,
+	"Sensor streams exceed 75% of AVB_LINK_MBPS, lower the ODR or raise the Tx interval");
+
+static void clear_data(struct avb_sensor_data *data)
 {
-	/* Wait for network_init() to be called, i.e. setting ->data */
-	do {
-		k_sleep(K_MSEC(100));
-	} while (ninfo.data == NULL);
+	if (!data)
+		return;
+	memset(data->accel, 0, sizeof(data->accel));
+	memset(data->gyro , 0, sizeof(data->gyro));
+	data->accel_ctr = 0;
+	data->gyro_ctr = 0;
+}
 
-	/*
-	 * Run periodically at X Hz (find this in .1BA/.1Q#L
-	 * FIXME: add a timer (prematurely) stopped callback
-	 *
-	 * Currently this is hardcoded to run at 100Hz, we replenish
-	 * with 1 framesize every 10ms.
-	 *
-	 * This is *not* the correct way.
-	 */
-	k_timer_init(&cbs_timer, cbs_timeout, NULL);
+static int pdu_add_data(struct avb_stream *s, struct avb_sensor_data *data, struct avtp_stream_pdu *pdu)
+{
+	if (!s || !data || !pdu)
+		return -EINVAL;;
 
-	/* Refill with 100Hz, try to avoid too high overhead whilst
-	 * testing and debugging.
+	/* running/ready are only flipped by main(), no need to grab the
+	 * data lock just to peek at them.
 	 */
-	printf("Running refill-task every %u usec\n", (int)(ninfo.idleSlope_period_ns / 1e3));
-	k_timer_start(&cbs_timer, K_USEC(0), K_USEC((int)(ninfo.idleSlope_period_ns / 1e3)));
-
-	while (1) {
-		k_sem_take(&cbs_credit_lock, K_FOREVER);
-
-		/* 1. Replenish credit
-		 *
-		 * In 802.1Q, idleSlope is used to describe the rate of
-		 * replensihing credits for a particular Stream
-		 * Class. Class A expects to transmit frames every 125us
-		 * (8kHz), B at 4kHz.
-		 *
-		 * This does not scale particularly well to a SW-only
-		 * approach, so we need network_init() to have
-		 * calculated idleSlope and _rate appropriately.
-		 */
+	if (!data->running) {
+		/* We are no longer running */
+		return -EIO;
+	} else if (!data->ready) {
+		/* data not yet ready (still in startup) */
+		return -ENODATA;
+	}
 
-		/* If we're below, we increment regardless of queue. */
-		if (ninfo.credit < 0) {
-			ninfo.credit += ninfo.idleSlope_refill;
-		} else if (ninfo.queue > 0) {
-			/* queued and credit was > 0, so increment, but cap at hiCredit */
-			ninfo.credit += ninfo.idleSlope_refill;
-			if (ninfo.credit > ninfo.hiCredit)
-				ninfo.credit = ninfo.hiCredit;
-		}
+	return payload_build(&s->fmt, data, pdu->avtp_payload);
+}
 
-		/* 2. notify waiters */
-		if(ninfo.credit >= 0) {
-			if (ninfo.queue > 0) {
-				k_sem_give(&cbs_can_tx);
-			} else {
-				/* no waiters, release excess credits */
-				ninfo.credit = 0;
-			}
-		}
-		k_sem_give(&cbs_credit_lock);
+/* Given whenever the stack is done with a frame (Tx buffer released,
+ * Tx callback run), so a sender with every stream held back knows
+ * when to look again.
+ */
+static K_SEM_DEFINE(tx_done, 0, 1);
 
-		/* 3. Wait for timer and goto #1*/
-		k_sem_take(&cbs_timer_sem, K_FOREVER);
-	}
+static bool tx_done_wait(k_timeout_t timeout)
+{
+	return k_sem_take(&tx_done, timeout) == 0;
 }
 
-
-/* Grab hold of the credit value before transmitting.
- *
- * If the credit is 0, this function will block and the caller must wait
- * for the credits to be replensished.
+#ifdef CONFIG_AVB_TX_ZERO_COPY
+/*
+ * Zero-copy Tx
  *
- * Once it returs (provided 0), the caller now has the 'credit lock' and
- * is the sole thread capable of transmitting.
+ * Packets come from a dedicated slab and buffer pool, so the sensor
+ * stream never competes with the rest of the stack (gPTP etc.) for Tx
+ * packets. Each buffer holds a complete frame: Ethernet (+VLAN) header,
+ * AVTP header and payload are written in place and the packet is handed
+ * to L2 as a raw AF_PACKET frame, no intermediate copy.
  */
-int cbs_credit_get(void)
+#ifdef CONFIG_AVB_LATENCY_STATS
+/* Hand-over time of the frame in each buffer, 0 if never sent. */
+static uint32_t tx_sent_cyc[CONFIG_AVB_TX_PKT_COUNT];
+#endif
+
+static void tx_buf_destroy(struct net_buf *buf)
 {
-	if (k_sem_take(&cbs_credit_lock, K_FOREVER) == 0) {
-		ninfo.queue++;
-		k_sem_give(&cbs_credit_lock);
-		return k_sem_take(&cbs_can_tx, K_FOREVER);
+#ifdef CONFIG_AVB_LATENCY_STATS
+	uint32_t *sent = &tx_sent_cyc[net_buf_id(buf)];
+
+	if (*sent)
+		latency_add_cyc(LAT_TX_DONE, *sent);
+	*sent = 0;
+#endif
+	net_buf_destroy(buf);
+	k_sem_give(&tx_done);
+}
+
+NET_PKT_TX_SLAB_DEFINE(avb_tx_pkts, CONFIG_AVB_TX_PKT_COUNT);
+NET_BUF_POOL_FIXED_DEFINE(avb_tx_bufs, CONFIG_AVB_TX_PKT_COUNT,
+			ETH_HDR_MAX + PDU_BUF_SZ, CONFIG_NET_BUF_USER_DATA_SIZE, tx_buf_destroy);
+
+static void tx_eth_hdr_init(struct avb_stream *s)
+{
+	uint8_t *pos = s->eth_hdr;
+
+	memcpy(pos, s->dst_addr, sizeof(s->dst_addr));
+	pos += sizeof(s->dst_addr);
+	memcpy(pos, net_if_get_link_addr(ninfo.iface)->addr, sizeof(struct net_eth_addr));
+	pos += sizeof(struct net_eth_addr);
+
+	if (s->sc != CLASS_NONE) {
+		sys_put_be16(NET_ETH_PTYPE_VLAN, pos);
+		sys_put_be16((s->prio << 13) | CONFIG_NET_VLAN_TAG_AVB, pos + 2);
+		pos += VLAN_SZ;
 	}
-	return -EBUSY;
+	sys_put_be16(AVB_ETH_TYPE, pos);
+	pos += sizeof(uint16_t);
+
+	s->eth_hdr_len = pos - s->eth_hdr;
 }
 
-/* Decrement the credit with the consumed size of the transmitted
- * data. The functino will also release the 'credit-lock'
+/* Grab a packet for the next frame of s with the Ethernet header in
+ * place.
  *
- * Size in bytes
+ * Never blocks, a NULL return means the pool is exhausted (driver
+ * still holding previous frames).
  */
-int cbs_credit_put(int payload_sz)
-{
-	if (k_sem_take(&cbs_credit_lock, K_FOREVER) == 0) {
-		/* We have sent, less pressure on the queue */
-		ninfo.queue--;
-
-		/* reduce credit with transmitted data
-		 *
-		 * data size + avtp headers (PDU_SIZE), ethernet
-		 * headers, IPG etc.
-		 *
-		 * Credits are in bits
-		 */
-		int tx_sz = payload_sz + sizeof(struct avtp_stream_pdu) + L1_SZ + L2_SZ + VLAN_SZ;
-		ninfo.credit -= tx_sz*8;
-
-		k_sem_give(&cbs_credit_lock);
-		return 0;
+static struct net_pkt *tx_pkt_alloc(struct avb_stream *s)
+{
+	struct net_pkt *pkt = net_pkt_alloc_from_slab(&avb_tx_pkts, K_NO_WAIT);
+	if (!pkt)
+		return NULL;
+
+	struct net_buf *buf = net_buf_alloc(&avb_tx_bufs, K_NO_WAIT);
+	if (!buf) {
+		net_pkt_unref(pkt);
+		return NULL;
 	}
-	return -EBUSY;
+	net_pkt_append_buffer(pkt, buf);
+
+	net_pkt_set_iface(pkt, ninfo.iface);
+	net_pkt_set_family(pkt, AF_PACKET);
+	net_pkt_set_priority(pkt, s->prio);
+
+	memcpy(net_buf_add(buf, s->eth_hdr_len), s->eth_hdr, s->eth_hdr_len);
+	return pkt;
 }
 
-static void clear_data(struct avb_sensor_data *data)
+static struct avtp_stream_pdu *tx_pkt_pdu(struct net_pkt *pkt)
 {
-	if (!data)
-		return;
-	memset(data->accel, 0, 3 * sizeof(struct sensor_value));
-	memset(data->gyro , 0, 3 * sizeof(struct sensor_value));
-	memset(data->magn , 0, 3 * sizeof(struct sensor_value));
-	memset(&data->temp , 0,     sizeof(struct sensor_value));
-	data->accel_ts = 0;
-	data->accel_ctr = 0;
-	data->gyro_ts = 0;
-	data->gyro_ctr = 0;
+	return (struct avtp_stream_pdu *)net_buf_tail(pkt->buffer);
 }
 
-int pdu_add_data(struct avb_sensor_data *data, struct avtp_stream_pdu *pdu)
+/* Commit PDU + payload_sz bytes of payload and hand the frame to L2.
+ * The packet is consumed regardless of outcome.
+ */
+static int tx_pkt_send(struct net_pkt *pkt, int payload_sz)
 {
-	if (!data || !pdu)
-		return -EINVAL;;
+	net_buf_add(pkt->buffer, sizeof(struct avtp_stream_pdu) + payload_sz);
 
-	if (data_get(data) == 0) {
-		if (!data->running) {
-			/* We are no longer running */
-			data_put(data);
-			return -EIO;
-		}
-		else if (!data->ready) {
-			/* data not yet ready (still in startup) */
-			data_put(data);
-			return -ENODATA;
-		}
-		/*
-		 * if (!(data->accel_ctr == 1 && data->gyro_ctr == 1)) :
-		 *
-		 * We are not completely in synch with polling
-		 * Either we:
-		 *  - overproduce (ctr > 1)
-		 *  - underproduce (ctr == 0)
-		 *
-		 * For now, let the receiver handle this and send data
-		 * packets at the defined rate.
-		 *
-		 */
+	int ret = net_send_data(pkt);
+	if (ret < 0)
+		net_pkt_unref(pkt);
+	return ret;
+}
+#endif /* CONFIG_AVB_TX_ZERO_COPY */
 
-		struct sensor_set *set = (struct sensor_set *)pdu->avtp_payload;
-		/* all values are in micro-units */
-		for (int i = 0; i < 3; i++) {
-			set->magn[i]  = sensor_value_to_micro(&data->magn[i]);
-			set->gyro[i]  = sensor_value_to_micro(&data->gyro[i]);
-			set->accel[i] = sensor_value_to_micro(&data->accel[i]);
-		}
-		set->temp = sensor_value_to_micro(&(data->temp));
+#ifdef CONFIG_NET_PKT_FILTER
+/*
+ * Drop our own frames looped back while gPTP keeps the iface in
+ * promiscous mode, straight from net_recv_data(), i.e. before they are
+ * queued to the Rx thread or delivered to a socket.
+ */
+static uint8_t own_mac[sizeof(struct net_eth_addr)];
+
+static bool own_avb_frame(struct npf_test *test, struct net_pkt *pkt)
+{
+	size_t len = net_pkt_get_len(pkt);
+
+	if (len < sizeof(struct net_eth_hdr))
+		return false;
 
-		/* Copy capture timestamps */
-		set->gyro_ts_ns = data->gyro_ts;
-		set->accel_ts_ns = data->accel_ts;
+	struct net_eth_hdr *hdr = NET_ETH_HDR(pkt);
+	uint16_t type = ntohs(hdr->type);
 
-		data_put(data);
-		return sizeof(*set);
+	if (type == NET_ETH_PTYPE_VLAN) {
+		if (len < sizeof(struct net_eth_vlan_hdr))
+			return false;
+		type = ntohs(((struct net_eth_vlan_hdr *)hdr)->type);
 	}
 
-	/* Failed getting data lock */
-	return -EBUSY;
+	return type == AVB_ETH_TYPE && !memcmp(hdr->src.addr, own_mac, sizeof(own_mac));
+}
+
+static struct {
+	struct npf_test test;
+} own_avb_test = {
+	.test.fn = own_avb_frame,
+};
+
+static NPF_RULE(drop_own_avb, NET_DROP, own_avb_test);
+
+static void rx_filter_init(struct net_linkaddr *link_addr)
+{
+	memcpy(own_mac, link_addr->addr, MIN(link_addr->len, sizeof(own_mac)));
+
+	/* A non-empty rule list drops anything not matched, so let the
+	 * rest through explicitly.
+	 */
+	npf_insert_recv_rule(&drop_own_avb);
+	npf_append_recv_rule(&npf_default_ok);
+}
+#endif /* CONFIG_NET_PKT_FILTER */
+
+/* Low-pri worker that drains the Rx buffer of the AVB socket.
+ *
+ * We are sending L2 packets alongside gPTP, which places the iface in
+ * promiscous mode. This means that packets sent will end up in the
+ * receive queue, so we need to drain these to avoid filling up the Rx
+ * buffers
+ *
+ * https://github.com/zephyrproject-rtos/zephyr/issues/34865 (Einar's)
+ * https://github.com/zephyrproject-rtos/zephyr/issues/34462
+ * https://github.com/zephyrproject-rtos/zephyr/pull/34475
+ *
+ * With CONFIG_NET_PKT_FILTER our own frames never make it this far,
+ * and this only picks up 0x22f0 frames from other talkers. Frames are
+ * truncated into a small buffer, we only care about freeing them.
+ */
+void network_rx_drain(void)
+{
+	/* Wait for network_init() to be called, i.e. setting ->data */
+	do {
+		k_sleep(K_MSEC(100));
+	} while (ninfo.data == NULL);
+
+	char drain_buffer[32];
+
+	while (data_valid(ninfo.data)) {
+		int res = zsock_recv(ninfo.avb_socket, drain_buffer, sizeof(drain_buffer), 0);
+		if (res < 0) {
+			printf("[NETWORK] Rx drain failed (%d), stopping.\n", errno);
+			return;
+		}
+	}
 }
 
 void gather_net_info(struct net_if *iface, void *user_data)
@@ -281,13 +411,16 @@ void gather_net_info(struct net_if *iface, void *user_data)
 		info->max_mtu = iface->if_dev->mtu;
 }
 
-int network_init(struct avb_sensor_data *sensor_data,
-		uint64_t tx_interval_ns,
-		enum avb_stream_class sc)
+int network_init(struct avb_sensor_data *sensor_data, enum avb_shaper shaper)
 {
 	if (!sensor_data)
 		return -EINVAL;
 
+	if (shaper == AVB_SHAPER_TAS && !IS_ENABLED(CONFIG_AVB_TAS)) {
+		printf("Time-aware shaper requested, but CONFIG_AVB_TAS is not set\n");
+		return -ENOTSUP;
+	}
+
 	memset(&ninfo, 0, sizeof(ninfo));
 
 	struct net_if *iface = net_if_get_first_by_type(&NET_L2_GET_NAME(ETHERNET));
@@ -302,65 +435,190 @@ int network_init(struct avb_sensor_data *sensor_data,
 	struct net_linkaddr *link_addr = net_if_get_link_addr(iface);
 	printf("Link_addr length=%d, type=%d MAC=", link_addr->len, link_addr->type);
 	for (int i = 0; i<link_addr->len; i++) {
-		ninfo.stream_id.u8[i] = link_addr->addr[i];
 		printf("%02x:", link_addr->addr[i]);
 	}
 	printf("\n");
-	ninfo.stream_id.u8[6] = (STREAM_ID >> 8) & 0xFF;
-	ninfo.stream_id.u8[7] = STREAM_ID & 0xFF;
-	printf("StreamID: %016llu (0x%016llx) \n", ninfo.stream_id.u64, ninfo.stream_id.u64);
-	/* If we're using an explicit stream-class, create a vlan and
-	 * create the context to go with it.
+
+	/*
+	 * Regardless of context and stream-classes, weneed a convenient
+	 * way of draining the receive buffer since gPTP opens the NIC
+	 * in promiscous mode.
+	 *
+	 * The protocol is compared against the EtherType in network
+	 * byte order, as for sll_protocol when sending. The plain
+	 * 0x22f0 used before only matched on big-endian CPUs.
 	 */
-	if (sc != CLASS_NONE) {
-		int ret = net_eth_vlan_enable(iface, CONFIG_NET_VLAN_TAG_AVB);
+	ninfo.avb_socket = zsock_socket(AF_PACKET, SOCK_DGRAM, htons(AVB_ETH_TYPE));
+	if (ninfo.avb_socket < 0) {
+		printf("Cannot create socket (%d)\n", ninfo.avb_socket);
+		return -EINVAL;
+	}
+#ifdef CONFIG_NET_PKT_FILTER
+	rx_filter_init(link_addr);
+#endif
+
+	/* 1. Find port rate (portTransmitRate) and max MTU*/
+	ninfo.portTxRate = 100000000;
+	ninfo.max_mtu = iface->if_dev->mtu;
+	ninfo.iface = iface;
+	ninfo.shaper = shaper;
+#if defined(CONFIG_NET_PKT_TXTIME) && defined(CONFIG_AVB_TX_ZERO_COPY)
+	ninfo.txtime = !!(caps & ETHERNET_TXTIME);
+#endif
+	printf("Launch time           : %s\n", ninfo.txtime ? "HW (txtime)" : "SW");
+
+	ninfo.data = sensor_data;
+	return 0;
+}
+
+/* Strict priority, lower is served first */
+static int class_rank(enum avb_stream_class sc)
+{
+	switch (sc) {
+	case CLASS_A:
+		return 0;
+	case CLASS_B:
+		return 1;
+	default:
+		return 2;
+	}
+}
+
+/* If we're using an explicit stream-class, create a vlan and
+ * create the context to go with it.
+ */
+static int stream_ctx_init(struct avb_stream *s)
+{
+	int ret;
+
+	if (!ninfo.vlan_enabled) {
+		ret = net_eth_vlan_enable(ninfo.iface, CONFIG_NET_VLAN_TAG_AVB);
 		if (ret < 0) {
 			printf("Failed activating VLAN:%d (%d)",
 				CONFIG_NET_VLAN_TAG_AVB, ret);
 			return -EINVAL;
 		}
-		ret = net_context_get(AF_PACKET, SOCK_DGRAM, IPPROTO_RAW, &ninfo.avb_ctx);
-		if (ret != 0) {
-			printf("Failed getting context for outgoing frames\n");
-			return -EINVAL;
-		}
+		ninfo.vlan_enabled = true;
+	}
 
-		struct sockaddr_ll addr = {
-			.sll_family = AF_PACKET,
-			.sll_protocol = htons(0x22f0),
-			.sll_ifindex = 1,
-			.sll_halen = 6,
-		};
-		ret = net_context_bind(ninfo.avb_ctx,
-				(struct sockaddr *)&addr,
-				sizeof(struct sockaddr_ll));
-		if (ret < 0) {
-			printf("Failed binding to context (%d)\n", ret);
-			return -EINVAL;
-		}
+	ret = net_context_get(AF_PACKET, SOCK_DGRAM, IPPROTO_RAW, &s->avb_ctx);
+	if (ret != 0) {
+		printf("Failed getting context for outgoing frames\n");
+		return -EINVAL;
+	}
+
+	struct sockaddr_ll addr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(AVB_ETH_TYPE),
+		.sll_ifindex = 1,
+		.sll_halen = 6,
+	};
+	ret = net_context_bind(s->avb_ctx,
+			(struct sockaddr *)&addr,
+			sizeof(struct sockaddr_ll));
+	if (ret < 0) {
+		printf("Failed binding to context (%d)\n", ret);
+		return -EINVAL;
+	}
+
+	ret = net_context_set_option(s->avb_ctx,
+				NET_OPT_PRIORITY,
+				&s->prio, sizeof(s->prio));
+	if (ret < 0) {
+		printf("Faield setting prio (%u) for context, %d\n", s->prio, ret);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+#ifdef CONFIG_AVB_TAS
+/* Rebuild the gate control list after a stream is added.
+ *
+ * Windows are laid out back to back from CONFIG_AVB_TAS_PHASE_NS in
+ * strict priority order, one window per stream every cycle it sends
+ * in. A stream sends every tx_interval, rounded up to a whole number of
+ * cycles.
+ */
+static int tas_gcl_update(void)
+{
+	if (CONFIG_AVB_TAS_PHASE_NS + (uint64_t)ninfo.n_streams * CONFIG_AVB_TAS_WINDOW_NS >
+		CONFIG_AVB_TAS_CYCLE_NS) {
+		printf("%d windows of %d ns do not fit in a %d ns cycle\n",
+			ninfo.n_streams, CONFIG_AVB_TAS_WINDOW_NS, CONFIG_AVB_TAS_CYCLE_NS);
+		return -EINVAL;
+	}
+
+	for (int i = 0; i < ninfo.n_streams; i++) {
+		struct avb_stream *s = ninfo.sched[i];
+		uint64_t cycles = DIV_ROUND_UP(s->tx_interval_ns, CONFIG_AVB_TAS_CYCLE_NS);
+
+		s->gate_offset_ns = CONFIG_AVB_TAS_PHASE_NS + (uint64_t)i * CONFIG_AVB_TAS_WINDOW_NS;
+		s->gate_period_ns = MAX(cycles, 1) * CONFIG_AVB_TAS_CYCLE_NS;
+		if (s->gate_period_ns != s->tx_interval_ns)
+			printf("WARNING! Tx interval %"PRIu64" ns not a multiple of TAS cycle, using %"PRIu64" ns\n",
+				s->tx_interval_ns, s->gate_period_ns);
+	}
+	return 0;
+}
+#endif
+
+int network_add_stream(unsigned int sensors,
+		uint64_t tx_interval_ns,
+		enum avb_stream_class sc)
+{
+	if (!ninfo.iface) {
+		printf("Network not initialized, cannot add stream\n");
+		return -EINVAL;
+	}
+	if (ninfo.n_streams >= CONFIG_AVB_MAX_STREAMS) {
+		printf("Out of streams (CONFIG_AVB_MAX_STREAMS=%d)\n", CONFIG_AVB_MAX_STREAMS);
+		return -ENOMEM;
+	}
+
+	int idx = ninfo.n_streams;
+	struct avb_stream *s = &ninfo.streams[idx];
+	struct net_linkaddr *link_addr = net_if_get_link_addr(ninfo.iface);
 
+	memset(s, 0, sizeof(*s));
+	for (int i = 0; i < link_addr->len && i < 6; i++)
+		s->stream_id.u8[i] = link_addr->addr[i];
+	s->stream_id.u8[6] = ((STREAM_ID + idx) >> 8) & 0xFF;
+	s->stream_id.u8[7] = (STREAM_ID + idx) & 0xFF;
+
+	/* One multicast group per stream */
+	memcpy(s->dst_addr, ether_mcast_addr, sizeof(s->dst_addr));
+	s->dst_addr[sizeof(s->dst_addr) - 1] += idx;
+
+	s->sc = sc;
+	s->tx_interval_ns = tx_interval_ns;
+	if (sc != CLASS_NONE) {
 		/* From 802.1BA and friends
 		 * (Unless otherwise configured by a network-admin)
 		 */
-		uint8_t prio = sc == CLASS_A ? 3 : 2;
-		ret = net_context_set_option(ninfo.avb_ctx,
-					NET_OPT_PRIORITY,
-					&prio, sizeof(prio));
-		if (ret < 0) {
-			printf("Faield setting prio (%u) for context, %d\n", prio, ret);
+		s->prio = sc == CLASS_A ? 3 : 2;
+		if (stream_ctx_init(s))
 			return -EINVAL;
-		}
 	}
+#ifdef CONFIG_AVB_TX_ZERO_COPY
+	tx_eth_hdr_init(s);
+#endif
 
-	/* 1. Find port rate (portTransmitRate) and max MTU*/
-	ninfo.portTxRate = 100000000;
-	ninfo.max_mtu = iface->if_dev->mtu;
-
-	ninfo.data = sensor_data;
-	ninfo.tx_interval_ns = tx_interval_ns;
+	/* Pack as many samples per frame as configured, but never more
+	 * than what fits in a single frame.
+	 */
+	if (payload_init(&s->fmt, sensors, CONFIG_AVB_BATCH_SIZE, MIN(ninfo.max_mtu, PDU_BUF_SZ))) {
+		printf("MTU (%d) too small for sensor payload\n", ninfo.max_mtu);
+		return -EINVAL;
+	}
+	if (s->fmt.batch_n < CONFIG_AVB_BATCH_SIZE)
+		printf("WARNING! Batch of %d samples exceeds MTU, capped to %d\n",
+			CONFIG_AVB_BATCH_SIZE, s->fmt.batch_n);
+	s->payload_sz = payload_max_size(&s->fmt);
 
-	ninfo.sc = sc;
-	ninfo.maxFrameSize = (PDU_SIZE + L2_SZ + VLAN_SZ + L1_SZ)*8;
+	/* Reserve for a full batch, frames with fewer samples simply
+	 * consume less credit.
+	 */
+	s->maxFrameSize = (sizeof(struct avtp_stream_pdu) + s->payload_sz + L2_SZ + VLAN_SZ + L1_SZ)*8;
 
 	/* idleSlope is the rate of refill and is the total size * observation interval.
 	 *
@@ -382,152 +640,632 @@ int network_init(struct avb_sensor_data *sensor_data,
 	 * So we cheat. As long as sensor_data is < max MTU, we send
 	 * everything in a single frame and refill credits based on
 	 * tx_interval.
+	 *
+	 * With CONFIG_AVB_BATCH_SIZE > 1, every sample produced during
+	 * tx_interval is packed into the same frame, so the sensors can
+	 * run at much higher rates than the frame rate. maxFrameSize
+	 * (and with it idleSlope) grows with the batch.
 	 */
-	ninfo.idleSlope = ninfo.maxFrameSize * ((double)1e9 / ninfo.tx_interval_ns);
-	ninfo.sendSlope = ninfo.idleSlope - ninfo.portTxRate;
+	s->idleSlope = s->maxFrameSize * ((double)1e9 / s->tx_interval_ns);
+	s->sendSlope = s->idleSlope - ninfo.portTxRate;
 
-	/* We implement CBS in SW, so use a timer with a known period and scale refill to this period.
-	 *
-	 * Note: we do not know the /exact/ time between two timers
-	 * fire, but it should be a periodic timer, so over time it
-	 * should be correct.
+	/* Need to do jump through some hoops to avoid integer overflow */
+	s->loCredit = ((int64_t)s->maxFrameSize * s->sendSlope) / (int64_t)ninfo.portTxRate;
+	s->hiCredit = ((int64_t)ninfo.max_mtu * 8  * (s->idleSlope) / (int64_t)ninfo.portTxRate);
+
+	/* Credit is computed lazily from the cycle counter whenever
+	 * the sender asks for it, see cbs.h.
 	 */
-	ninfo.idleSlope_period_ns = 1000 * NSEC_PER_USEC;
-	ninfo.idleSlope_rate = 1000000000L / ninfo.idleSlope_period_ns;
-	if (ninfo.idleSlope % ninfo.idleSlope_rate) {
-		printf("WARNING! We have fractional idleSlope rate!\n");
-		printf("Filling every round: %llu\n",  ninfo.idleSlope / ninfo.idleSlope_rate);
-		printf("Remainder: %f\n", (double)(ninfo.idleSlope % ninfo.idleSlope_rate)/ninfo.idleSlope_rate);
+	if (cbs_init(&s->cbs, s->idleSlope, s->hiCredit, s->loCredit) < 0) {
+		printf("Invalid CBS settings, idleSlope=%"PRId64"\n", s->idleSlope);
+		return -EINVAL;
 	}
-	ninfo.idleSlope_refill = ninfo.idleSlope / ninfo.idleSlope_rate;
 
+	/* AVTP header, everything but seq_num, time and length */
+	struct avtp_stream_pdu pdu;
+	avtp_stream_pdu_init(&pdu);
+	avtp_stream_pdu_set(&pdu, AVTP_STREAM_FIELD_STREAM_ID, s->stream_id.u64);
+	avtp_stream_pdu_set(&pdu, AVTP_STREAM_FIELD_FORMAT_SPECIFIC,
+			payload_format_specific(&s->fmt));
+	avtp_stream_tmpl_init(&s->tmpl, &pdu);
+
+	/* Insert into the scheduler, stable within a class */
+	int pos = idx;
+	while (pos > 0 && class_rank(ninfo.sched[pos - 1]->sc) > class_rank(sc)) {
+		ninfo.sched[pos] = ninfo.sched[pos - 1];
+		pos--;
+	}
+	ninfo.sched[pos] = s;
+	ninfo.n_streams++;
 
-	/* Need to do jump through some hoops to avoid integer overflow */
-	ninfo.loCredit = ((int64_t)ninfo.maxFrameSize * ninfo.sendSlope) / (int64_t)ninfo.portTxRate;
-	ninfo.hiCredit = ((int64_t)ninfo.max_mtu * 8  * (ninfo.idleSlope) / (int64_t)ninfo.portTxRate);
+#ifdef CONFIG_AVB_TAS
+	if (ninfo.shaper == AVB_SHAPER_TAS && tas_gcl_update())
+		return -EINVAL;
+#endif
 
+	printf("Stream %d: StreamID: %016llu (0x%016llx) \n", idx, s->stream_id.u64, s->stream_id.u64);
 	printf("Network CBS settings\n");
+	printf("  streamClass         = %10s\n", sc == CLASS_A ? "A" : sc == CLASS_B ? "B" : "none");
+	printf("  sensors             = %10s\n",
+		s->fmt.sensors == AVB_SENSOR_ALL ? "all" :
+		s->fmt.sensors == AVB_SENSOR_GYRO ? "gyro" :
+		s->fmt.sensors == AVB_SENSOR_QUAT ? "quat" : "accel");
 	printf("  portTxRate          = %10"PRIu64" bps\n", ninfo.portTxRate);
-	printf("  idleSlope           = %10"PRId64" bps\n", ninfo.idleSlope);
-	printf("  sendSlope           = %10"PRId64" bps\n", ninfo.sendSlope);
-	printf("  loCredit            = %10d bits\n", ninfo.loCredit);
-	printf("  hiCredit            = %10d bits\n", ninfo.hiCredit);
-	printf("  maxFrameSize        = %10d bits\n", ninfo.maxFrameSize);
+	printf("  idleSlope           = %10"PRId64" bps\n", s->idleSlope);
+	printf("  sendSlope           = %10"PRId64" bps\n", s->sendSlope);
+	printf("  loCredit            = %10d bits\n", s->loCredit);
+	printf("  hiCredit            = %10d bits\n", s->hiCredit);
+	printf("  maxFrameSize        = %10d bits\n", s->maxFrameSize);
 	printf("  maxInterferenceSize = %10d bytes\n", ninfo.max_mtu);
+	printf("  samplesPerFrame     = %10d\n", s->fmt.batch_n);
+	printf("  payloadFormat       = %10d (v%u)\n", s->fmt.id, s->fmt.version);
 	printf("Driver settings:\n");
-	printf("  refillPeriod        = %13.2f us\n", ninfo.idleSlope_period_ns/1e3);
-	printf("  refillRate          = %10d refills/sec\n", ninfo.idleSlope_rate);
-	printf("  refillAmount        = %10d bits/round\n", ninfo.idleSlope_refill);
-	return 0;
+	printf("  creditResolution    = %10u bit-cycles/bit\n", s->cbs.cyc_per_sec);
+#ifdef CONFIG_AVB_TAS
+	if (ninfo.shaper == AVB_SHAPER_TAS) {
+		printf("Gate control list\n");
+		for (int i = 0; i < ninfo.n_streams; i++)
+			printf("  stream %d             = %10"PRIu64" ns + n*%"PRIu64" ns, open %d ns\n",
+				(int)(ninfo.sched[i] - ninfo.streams),
+				ninfo.sched[i]->gate_offset_ns,
+				ninfo.sched[i]->gate_period_ns,
+				CONFIG_AVB_TAS_WINDOW_NS);
+	}
+#endif
+	return idx;
 }
 
 void avb_tx_callback(struct net_context *ctx, int status, void *data)
 {
-	struct net_info *n = (struct net_info *)data;
-	if (ctx == n->avb_ctx) {
-		cbs_credit_put(status > 0 ? status : 0);
+	struct avb_stream *s = (struct avb_stream *)data;
+
+#ifdef CONFIG_AVB_LATENCY_STATS
+	latency_add_cyc(LAT_TX_DONE, s->tx_sent_cyc);
+#endif
+	/* status counts the L2 and AVTP headers already, charge the
+	 * size recorded by frame_send() like the zero-copy path does.
+	 */
+	if (ctx == s->avb_ctx && ninfo.shaper == AVB_SHAPER_CBS) {
+		if (status < 0)
+			cbs_credit_cancel(&s->cbs);
+		else
+			cbs_credit_put(&s->cbs, s->in_flight_bits);
 	}
+	atomic_clear(&s->in_flight);
+	k_sem_give(&tx_done);
 }
 
-void network_sender(void)
+/* A frame being built in place, either in a zero-copy Tx packet or in
+ * the shared PDU buffer.
+ */
+struct tx_frame {
+	struct avtp_stream_pdu *pdu;
+#ifdef CONFIG_AVB_TX_ZERO_COPY
+	struct net_pkt *pkt;
+#endif
+	int sz;
+};
+
+/* Get a buffer for the next frame of s and fill in header and payload.
+ *
+ * Returns 0 when the frame is ready for frame_send(), negative if there
+ * is nothing to send (no buffer, no data). Nothing is held on error.
+ */
+static int frame_build(struct avb_stream *s, struct tx_frame *f)
 {
-	/* Wait for network_init() to be called, i.e. setting ->data */
-	do {
-		k_sleep(K_MSEC(100));
-	} while (ninfo.data == NULL);
+#ifdef CONFIG_AVB_TX_ZERO_COPY
+	f->pkt = tx_pkt_alloc(s);
+	if (!f->pkt) {
+		STREAM_STAT_ADD(s, skipped_nobufs, 1);
+		return -ENOBUFS;
+	}
+	f->pdu = tx_pkt_pdu(f->pkt);
+#else
+	static uint8_t pdu_buf[PDU_BUF_SZ] __aligned(4);
+	f->pdu = (struct avtp_stream_pdu *)pdu_buf;
+#endif
+	avtp_stream_tmpl_copy(&s->tmpl, f->pdu);
+
+	/* Collect data from _data */
+	uint32_t t0 = k_cycle_get_32();
+	f->sz = pdu_add_data(s, ninfo.data, f->pdu);
+	latency_add_cyc(LAT_PDU_BUILD, t0);
+#ifdef CONFIG_AVB_LATENCY_STATS
+	if (f->sz > 0) {
+		uint64_t capture_ns = payload_capture_ts(&s->fmt, f->pdu->avtp_payload);
+		uint64_t now = now_ns();
+
+		if (capture_ns && now > capture_ns)
+			latency_add(LAT_SAMPLE_AGE, (uint32_t)MIN(now - capture_ns, UINT32_MAX));
+	}
+#endif
+	if (f->sz <= 0) {
+#ifdef CONFIG_AVB_TX_ZERO_COPY
+		net_pkt_unref(f->pkt);
+#endif
+		STREAM_STAT_ADD(s, skipped_empty, 1);
+		return -ENODATA;
+	}
+	return 0;
+}
 
-	uint8_t seq_num = 0;
+/* Stamp the time-dependent header fields of a frame from frame_build()
+ * and hand it to the stack. The frame is consumed.
+ *
+ * launch_ns is the gPTP time the frame is due on the wire, 0 for
+ * now. With HW launch-time support the frame is handed over right
+ * away and the MAC holds it, otherwise the caller only calls this once
+ * it is due (tx_wait_until(), launch_wait()).
+ *
+ * When sent through a net_context, credit is charged from the Tx
+ * callback and the stream is marked in_flight until then, otherwise
+ * the caller charges it.
+ *
+ * Returns 0 on success, negative if the stack refused the frame.
+ */
+static int frame_send(struct avb_stream *s, struct tx_frame *f, uint64_t launch_ns)
+{
+	struct avtp_stream_pdu *pdu = f->pdu;
+	int ret;
+
+	uint64_t ptp_time_ns = now_ns();
+	uint64_t capture_ns = payload_capture_ts(&s->fmt, pdu->avtp_payload);
 
 	/*
-	 * Regardless of context and stream-classes, weneed a convenient
-	 * way of draining the receive buffer since gPTP opens the NIC
-	 * in promiscous mode.
+	 * 1722 presentation time: the listener should present the
+	 * (oldest) sample in the frame no earlier than max transit time
+	 * after it was captured. Only valid if our capture timestamps
+	 * are in the grandmaster's time base and there is a sample at
+	 * all.
 	 */
-	int avb_socket = zsock_socket(AF_PACKET, SOCK_DGRAM, 0x22f0);
-	if (avb_socket < 0) {
-		printf("[NETWORK] Cannot create socket (%d), aborting\n", avb_socket);
-		return;
-	}
-
+	bool tv = clock_synced() && capture_ns > 0;
+	uint32_t avtptime = (uint32_t)((capture_ns + CONFIG_AVB_MAX_TRANSIT_NS) & 0xffffffff);
+	avtp_stream_tmpl_update(&s->tmpl, pdu, s->seq_num, tv, tv ? avtptime : 0, f->sz);
+
+	payload_set_sent_ts(&s->fmt, pdu->avtp_payload, MAX(ptp_time_ns, launch_ns));
+#ifdef CONFIG_AVB_TX_ZERO_COPY
+#ifdef CONFIG_NET_PKT_TXTIME
+	if (launch_ns && ninfo.txtime)
+		net_pkt_set_txtime(f->pkt, launch_ns);
+#endif
+#ifdef CONFIG_AVB_LATENCY_STATS
+	tx_sent_cyc[net_buf_id(f->pkt->buffer)] = k_cycle_get_32();
+#endif
+	ret = tx_pkt_send(f->pkt, f->sz);
+	if (ret < 0)
+		printf("[NETWORK] Failed sending frame (%d)\n", ret);
+#else
 	/* Set destination */
-	const unsigned char ether_mcast_addr[] = {0x01, 0x00, 0x5E, 0x01, 0x11, 0x42};
-
 	struct sockaddr_ll addr;
 	addr.sll_family = AF_PACKET;
 	addr.sll_ifindex = 1;
-	addr.sll_protocol = 0xf022;
+	addr.sll_protocol = htons(AVB_ETH_TYPE);
 	addr.sll_halen = sizeof("xx:xx:xx:xx:xx:xx");
-	memcpy(addr.sll_addr, ether_mcast_addr, sizeof(ether_mcast_addr));
+	memcpy(addr.sll_addr, s->dst_addr, sizeof(s->dst_addr));
+
+	if (s->sc == CLASS_NONE) {
+		ret = zsock_sendto(ninfo.avb_socket, pdu, sizeof(*pdu) + f->sz, 0, (struct sockaddr *)&addr, sizeof(addr));
+	} else {
+#ifdef CONFIG_AVB_LATENCY_STATS
+		s->tx_sent_cyc = k_cycle_get_32();
+#endif
+		s->in_flight_bits = tx_bits(f->sz);
+		atomic_set(&s->in_flight, 1);
+		ret = net_context_sendto(s->avb_ctx,
+					pdu,
+					sizeof(*pdu) + f->sz,
+					(struct sockaddr *)&addr,
+					sizeof(addr),
+					(net_context_send_cb_t)avb_tx_callback, K_NO_WAIT, (void *)s);
+		// cbs_credit_puts() freed in callback
+		if (ret < 0) {
+			atomic_clear(&s->in_flight);
+			printf("Failed sending data using context, res=%d, stopping.\n", ret);
+			ninfo.data->running = false;
+		}
+	}
+#endif
 
+	if (ret < 0) {
+		STREAM_STAT_ADD(s, send_failed, 1);
+	} else {
+		STREAM_STAT_ADD(s, frames_sent, 1);
+		STREAM_STAT_ADD(s, bits_sent, tx_bits(f->sz));
+	}
+	s->seq_num++;
+	return ret < 0 ? ret : 0;
+}
 
-	struct avtp_stream_pdu *pdu = alloca(PDU_SIZE);
-	avtp_stream_pdu_init(pdu);
-	char drain_buffer[1500];
+#ifdef CONFIG_AVB_STATS
+/* Samples lost in the rings of the sensors s carries, since start */
+static uint32_t stream_ring_dropped(const struct avb_stream *s)
+{
+	uint32_t n = 0;
+
+	if (s->fmt.sensors & AVB_SENSOR_GYRO)
+		n += atomic_get(&ninfo.data->gyro_ring.dropped);
+	if (s->fmt.sensors & AVB_SENSOR_ACCEL)
+		n += atomic_get(&ninfo.data->accel_ring.dropped);
+#ifdef CONFIG_AVB_FUSION
+	if (s->fmt.sensors & AVB_SENSOR_QUAT)
+		n += atomic_get(&ninfo.data->quat_ring.dropped);
+#endif
+	return n;
+}
+
+/* Restart the counters of every stream, called by the sender so they
+ * keep a single writer.
+ */
+static void stats_restart(void)
+{
+	uint64_t now = now_ns();
+
+	for (int i = 0; i < ninfo.n_streams; i++) {
+		struct avb_stream *s = &ninfo.streams[i];
+
+		memset(&s->stats, 0, sizeof(s->stats));
+		s->stats_since_ns = now;
+		s->ring_dropped_base = stream_ring_dropped(s);
+		cbs_stats_reset(&s->cbs);
+#ifdef CONFIG_AVB_TAS
+		s->gate_missed = 0;
+#endif
+	}
+}
+
+static inline void stats_reset_poll(void)
+{
+	if (atomic_cas(&stats_reset_req, 1, 0))
+		stats_restart();
+}
+
+void network_stats_reset(void)
+{
+	atomic_set(&stats_reset_req, 1);
+}
+
+int network_stream_stats(int idx, struct avb_stream_stats *st)
+{
+	if (idx < 0 || idx >= ninfo.n_streams)
+		return -EINVAL;
+
+	struct avb_stream *s = &ninfo.streams[idx];
+	uint64_t now = now_ns();
+
+	memcpy(st, &s->stats, sizeof(*st));
+	st->sensors = s->fmt.sensors;
+	st->sc = s->sc;
+#ifdef CONFIG_AVB_TAS
+	st->gate_missed = s->gate_missed;
+#endif
+	st->ring_dropped = stream_ring_dropped(s) - s->ring_dropped_base;
+	cbs_stats(&s->cbs, &st->credit_min, &st->credit_max, &st->credit_underflows);
+	st->lo_credit = s->loCredit;
+	st->hi_credit = s->hiCredit;
+	st->elapsed_ns = s->stats_since_ns && now > s->stats_since_ns ? now - s->stats_since_ns : 0;
+	st->idle_slope = s->idleSlope;
+	return 0;
+}
+#else
+static inline void stats_reset_poll(void) {}
+
+void network_stats_reset(void) {}
+
+int network_stream_stats(int idx, struct avb_stream_stats *st)
+{
+	return -ENOTSUP;
+}
+#endif
+
+#ifdef CONFIG_AVB_TAS
+/* Release a frame at gPTP time launch_ns.
+ *
+ * Sleep on the local clock until CONFIG_AVB_TX_GUARD_NS before it, the
+ * guard absorbs tick granularity and the drift between the local clock
+ * and gPTP, then busy-wait on gPTP time. Returns the gPTP time at
+ * release.
+ */
+static uint64_t tx_wait_until(uint64_t launch_ns)
+{
+	uint64_t now = now_ns();
+
+	if (launch_ns > now + CONFIG_AVB_TX_GUARD_NS)
+		k_sleep(K_NSEC(launch_ns - now - CONFIG_AVB_TX_GUARD_NS));
+
+	while ((now = now_ns()) < launch_ns)
+		;
+	return now;
+}
+#endif
+
+#ifdef CONFIG_AVB_LAUNCH_ALIGN
+/* Next launch slot of s: every tx_interval on the gPTP time line, at
+ * CONFIG_AVB_LAUNCH_PHASE_NS into it. Nodes sharing interval and
+ * phase transmit in lock-step, different phases interleave.
+ */
+static uint64_t launch_next(struct avb_stream *s, uint64_t now)
+{
+	uint64_t phase = CONFIG_AVB_LAUNCH_PHASE_NS % s->tx_interval_ns;
+
+	if (now < phase)
+		return phase;
+	return ((now - phase) / s->tx_interval_ns + 1) * s->tx_interval_ns + phase;
+}
+
+/* Pin the slot of s once its frame has credit, and tell how long until
+ * it may be handed over: 0 when due (or when the MAC holds it until
+ * then), else the cycles to sleep until CONFIG_AVB_TX_GUARD_NS before
+ * the slot. A slot passed by more than the guard (another stream was
+ * sent meanwhile) is moved to the next one, a frame never goes out
+ * off its slot. Inside the guard *spin is set to the stream due first.
+ */
+static uint64_t launch_wait(struct avb_stream *s, uint64_t now, struct avb_stream **spin)
+{
+	if (!s->launch_ns || now > s->launch_ns + CONFIG_AVB_TX_GUARD_NS)
+		s->launch_ns = launch_next(s, now);
+	if (ninfo.txtime || now >= s->launch_ns)
+		return 0;
+	if (s->launch_ns - now <= CONFIG_AVB_TX_GUARD_NS) {
+		if (!*spin || s->launch_ns < (*spin)->launch_ns)
+			*spin = s;
+		return 1;
+	}
+	return k_ns_to_cyc_floor64(s->launch_ns - now - CONFIG_AVB_TX_GUARD_NS);
+}
+
+/* Busy-wait on gPTP time for the slot launch_wait() pinned for s, only
+ * called inside the guard so never for longer than
+ * CONFIG_AVB_TX_GUARD_NS.
+ */
+static void launch_spin(struct avb_stream *s)
+{
+	uint32_t start = k_cycle_get_32();
+	uint32_t max = k_ns_to_cyc_ceil32(CONFIG_AVB_TX_GUARD_NS);
+
+	while (now_ns() < s->launch_ns && k_cycle_get_32() - start < max)
+		k_busy_wait(1);
+}
+#endif
+
+/* Frames of s are sent through its net_context and credit is charged
+ * from avb_tx_callback(), not by the sender.
+ */
+static bool frame_charged_in_callback(struct avb_stream *s)
+{
+	return !IS_ENABLED(CONFIG_AVB_TX_ZERO_COPY) && s->sc != CLASS_NONE;
+}
+
+/* Build and send a single frame for s, credit has already been
+ * granted.
+ *
+ * Returns 0 if the frame went out, -ENOBUFS if the Tx pool is
+ * exhausted, other negative values if there was nothing to send or the
+ * stack refused it. Credit is only charged for a frame handed over.
+ */
+static int cbs_stream_send(struct avb_stream *s)
+{
+	uint64_t launch = 0;
+#ifdef CONFIG_AVB_LAUNCH_ALIGN
+	/* Credit only decided which interval the frame goes out in,
+	 * the slot within it is fixed and already due.
+	 */
+	launch = s->launch_ns;
+	s->launch_ns = 0;
+#endif
+	struct tx_frame f;
+	int ret = frame_build(s, &f);
 
-	/* Wait for data to become ready, max 30 sec */
-	int ret = data_wait_ready(ninfo.data, 30000);
 	if (ret < 0) {
-		printf("[NETWORK] Data not available (%d), aborting Tx-thread after 30 sec timeout.\n", ret);
-		return;
+		/* Nothing to send, do not keep a queued frame
+		 * accumulating credit.
+		 */
+		cbs_credit_cancel(&s->cbs);
+		return ret;
 	}
 
+	ret = frame_send(s, &f, launch);
+	if (ret < 0)
+		cbs_credit_cancel(&s->cbs);
+	else if (!frame_charged_in_callback(s))
+		cbs_credit_put(&s->cbs, tx_bits(f.sz));
+	return ret;
+}
+
+static void cbs_sender(void)
+{
+	/* Streams that found the Tx pool empty, skipped until the driver
+	 * releases a buffer so the others keep going.
+	 */
+	uint32_t nobufs = 0;
+
 	while (data_valid(ninfo.data)) {
-		/* 1. Block until we have 0 or positive credit */
-		cbs_credit_get();
-
-		/* 2. Collect data from _data */
-		int sz = pdu_add_data(ninfo.data, pdu);
-		if (sz == DATA_LEN) {
-
-			/* 3. Construct rest of PDU */
-			avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_STREAM_ID, ninfo.stream_id.u64);
-			avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_STREAM_DATA_LEN, sz);
-			avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_SEQ_NUM, seq_num);
-
-			/* FIXME: validate gptp, is TV valid? */
-			uint64_t ptp_time_ns = gptp_ts();
-			uint32_t avtptime = (uint32_t)(ptp_time_ns & 0xffffffff);
-			avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_TV, 1);
-			avtp_stream_pdu_set(pdu, AVTP_STREAM_FIELD_TIMESTAMP, avtptime);
-
-			/* 4. Transmit data  */
-			((struct sensor_set *)pdu->avtp_payload)->sent_ts_ns = gptp_ts();
-			if (ninfo.sc == CLASS_NONE) {
-				zsock_sendto(avb_socket, pdu, PDU_SIZE, 0, (struct sockaddr *)&addr, sizeof(addr));
-				cbs_credit_put(sz > 0 ? sz : 0);
-			} else {
-				int ret = net_context_sendto(ninfo.avb_ctx,
-							pdu,
-							PDU_SIZE,
-							(struct sockaddr *)&addr,
-							sizeof(addr),
-							(net_context_send_cb_t)avb_tx_callback, K_NO_WAIT, (void *)&ninfo);
-				// cbs_credit_puts() freed in callback
-				if (ret < 0) {
-					printf("Failed sending data using context, res=%d, stopping.\n", ret);
-					ninfo.data->running = false;
-				}
+		struct avb_stream *next = NULL;
+		int next_i = 0;
+		uint64_t wait = UINT64_MAX;
+		bool held = false;
+#ifdef CONFIG_AVB_LAUNCH_ALIGN
+		struct avb_stream *spin = NULL;
+		uint64_t now = now_ns();
+#endif
+
+		stats_reset_poll();
+		if (nobufs && tx_done_wait(K_NO_WAIT))
+			nobufs = 0;
+
+		/*
+		 * Every stream always has a frame pending, so all of
+		 * them are polled. A stream held back by a higher class
+		 * keeps accumulating credit, as it would behind a HW
+		 * shaper. The highest class with credit >= 0 is sent.
+		 */
+		for (int i = 0; i < ninfo.n_streams; i++) {
+			/* Out of buffers, or credit of the last frame not
+			 * charged yet (it would be polled on stale credit).
+			 */
+			if ((nobufs & BIT(i)) || atomic_get(&ninfo.sched[i]->in_flight)) {
+				held = true;
+				continue;
 			}
 
-			/* Rip out multiple messages quickly.
-			 *
-			 * We are sending L2 packets alongside gPTP,
-			 * which places the iface in promiscous
-			 * mode. This means that packets sent will end
-			 * up in the receive queue, so we need to drain
-			 * these to avoid filling up the Rx buffers
-			 *
-			 * https://github.com/zephyrproject-rtos/zephyr/issues/34865 (Einar's)
-			 * https://github.com/zephyrproject-rtos/zephyr/issues/34462
-			 * https://github.com/zephyrproject-rtos/zephyr/pull/34475
+			uint64_t w = cbs_credit_poll(&ninfo.sched[i]->cbs);
+#if defined(CONFIG_AVB_LATENCY_STATS) || defined(CONFIG_AVB_STATS)
+			if (w > 0 && !ninfo.sched[i]->credit_waiting) {
+				ninfo.sched[i]->credit_waiting = true;
+				ninfo.sched[i]->credit_wait_cyc = k_cycle_get_32();
+			}
+#endif
+#ifdef CONFIG_AVB_LAUNCH_ALIGN
+			/* With credit, wait for the slot without holding
+			 * up streams that are due.
 			 */
-			int res;
-			do {
-				res = recv(avb_socket, drain_buffer, sizeof(drain_buffer), MSG_DONTWAIT);
-			} while (res > 0);
+			if (w == 0)
+				w = launch_wait(ninfo.sched[i], now, &spin);
+#endif
 
-			seq_num++;
+			if (w == 0 && !next) {
+				next = ninfo.sched[i];
+				next_i = i;
+			}
+			wait = MIN(wait, w);
 		}
 
+		if (!next) {
+#ifdef CONFIG_AVB_LAUNCH_ALIGN
+			/* About to reach a launch slot, wait for that stream
+			 * only and poll the others again once it is due.
+			 */
+			if (spin) {
+				launch_spin(spin);
+				continue;
+			}
+#endif
+
+			/* No stream has credit, sleep until the first one
+			 * does or a held back one may go again.
+			 */
+			if (wait == UINT64_MAX)
+				wait = sys_clock_hw_cycles_per_sec() / MSEC_PER_SEC;
+			if (held) {
+				tx_done_wait(K_CYC(wait));
+				nobufs = 0;
+			} else {
+				k_sleep(K_CYC(wait));
+			}
+			continue;
+		}
+
+#if defined(CONFIG_AVB_LATENCY_STATS) || defined(CONFIG_AVB_STATS)
+		/* Frames sent on credit that was already there count as 0 */
+		uint32_t waited = next->credit_waiting ?
+			k_cyc_to_ns_floor32(k_cycle_get_32() - next->credit_wait_cyc) : 0;
+
+		next->credit_waiting = false;
+		latency_add(LAT_CREDIT_WAIT, waited);
+#ifdef CONFIG_AVB_STATS
+		next->stats.credit_wait_ns += waited;
+		next->stats.credit_wait_max_ns = MAX(next->stats.credit_wait_max_ns, waited);
+#endif
+#endif
+		if (cbs_stream_send(next) == -ENOBUFS)
+			nobufs |= BIT(next_i);
+	}
+}
+
+#ifdef CONFIG_AVB_TAS
+/* Start of the first window of s that is still open at now and has not
+ * been used yet. Windows repeat every gate_period_ns, aligned to gPTP
+ * time 0, so every node using the same GCL opens at the same instant.
+ */
+static uint64_t gate_next_open(struct avb_stream *s, uint64_t now)
+{
+	uint64_t start = s->gate_offset_ns;
+
+	if (now > start + CONFIG_AVB_TAS_WINDOW_NS)
+		start += ((now - start - CONFIG_AVB_TAS_WINDOW_NS) / s->gate_period_ns + 1) * s->gate_period_ns;
+
+	if (start <= s->gate_last)
+		start = s->gate_last + s->gate_period_ns;
+
+	return start;
+}
+
+static void tas_sender(void)
+{
+	while (data_valid(ninfo.data)) {
+		uint64_t now = now_ns();
+		struct avb_stream *next = NULL;
+		uint64_t open = UINT64_MAX;
+
+		stats_reset_poll();
+
+		for (int i = 0; i < ninfo.n_streams; i++) {
+			uint64_t t = gate_next_open(ninfo.sched[i], now);
+
+			if (t < open) {
+				open = t;
+				next = ninfo.sched[i];
+			}
+		}
+		if (!next) {
+			k_sleep(K_MSEC(1));
+			continue;
+		}
+
+		/* Sleep on the local clock until just before the window */
+		if (open > now + CONFIG_AVB_TX_GUARD_NS) {
+			k_sleep(K_NSEC(open - now - CONFIG_AVB_TX_GUARD_NS));
+			continue;
+		}
+
+		/* Build the frame ahead of the gate, so only the timestamp
+		 * and the hand-over to L2 happen inside the window.
+		 */
+		next->gate_last = open;
+		struct tx_frame f;
+		int ret = frame_build(next, &f);
+		if (ret < 0)
+			continue;
+
+		if (ninfo.txtime)
+			now = now_ns();
+		else
+			now = tx_wait_until(open);
+
+		if (now >= open + CONFIG_AVB_TAS_WINDOW_NS) {
+			/* Preempted past the window, do not send out of it */
+#ifdef CONFIG_AVB_TX_ZERO_COPY
+			net_pkt_unref(f.pkt);
+#endif
+			next->gate_missed++;
+			continue;
+		}
+		frame_send(next, &f, open);
+	}
+}
+#endif /* CONFIG_AVB_TAS */
+
+void network_sender(void)
+{
+	/* Wait for network_init() to be called, i.e. setting ->data */
+	do {
+		k_sleep(K_MSEC(100));
+	} while (ninfo.data == NULL);
+
+	/* Wait for data to become ready, max 30 sec */
+	int ret = data_wait_ready(ninfo.data, 30000);
+	if (ret < 0) {
+		printf("[NETWORK] Data not available (%d), aborting Tx-thread after 30 sec timeout.\n", ret);
+		return;
+	}
+
+	/* Count from when data starts flowing */
+	network_stats_reset();
+
+#ifdef CONFIG_AVB_TAS
+	if (ninfo.shaper == AVB_SHAPER_TAS) {
+		tas_sender();
+		return;
 	}
+#endif
+	cbs_sender();
 }
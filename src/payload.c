@@ -0,0 +1,610 @@
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+
+#include "common.h"
+#include "avtp.h"
+#include "payload.h"
+#include "codec.h"
+#include "align.h"
+
+#ifdef CONFIG_AVB_PAYLOAD_ALIGNED
+/* One grid point per sample period of the faster sensor */
+#define ALIGN_PERIOD_NS		(NSEC_PER_SEC / AVB_RATE_MAX_HZ)
+
+/* Resampler state, there is a single stream with this format */
+static struct align_state align;
+
+/* First grid point after a gap, held back for the next frame */
+static struct aligned_sample align_held;
+static bool align_have_held;
+#endif
+
+static size_t record_size(const struct payload_fmt *fmt)
+{
+	bool g = fmt->sensors & AVB_SENSOR_GYRO;
+	bool a = fmt->sensors & AVB_SENSOR_ACCEL;
+
+	switch (fmt->id) {
+	case AVB_FMT_BATCH:
+		return g * sizeof(struct gyro_set) + a * sizeof(struct accel_set);
+	case AVB_FMT_COMPACT:
+		return g * sizeof(struct compact_gyro) + a * sizeof(struct compact_accel);
+	case AVB_FMT_ALIGNED:
+		return sizeof(struct aligned_set);
+	case AVB_FMT_QUAT:
+		return sizeof(struct quat_set);
+	default:
+		return 0;
+	}
+}
+
+static size_t header_size(const struct payload_fmt *fmt)
+{
+	switch (fmt->id) {
+	case AVB_FMT_BATCH:
+		return sizeof(struct sensor_batch_hdr);
+	case AVB_FMT_COMPACT:
+	case AVB_FMT_PACKED:
+		return sizeof(struct compact_hdr);
+	case AVB_FMT_ALIGNED:
+		return sizeof(struct aligned_hdr);
+	case AVB_FMT_QUAT:
+		return sizeof(struct quat_hdr);
+	default:
+		return sizeof(struct sensor_set);
+	}
+}
+
+int payload_init(struct payload_fmt *fmt, unsigned int sensors, int batch_n, int max_mtu)
+{
+	if (!fmt || !(sensors & (AVB_SENSOR_ALL | AVB_SENSOR_QUAT)))
+		return -EINVAL;
+
+	fmt->sensors = sensors & AVB_SENSOR_ALL;
+
+	int room = max_mtu - sizeof(struct avtp_stream_pdu);
+
+	if (sensors & AVB_SENSOR_QUAT) {
+		/* Orientation only, whatever the raw format */
+		fmt->sensors = AVB_SENSOR_QUAT;
+		fmt->id = AVB_FMT_QUAT;
+		fmt->version = 0;
+	} else if (IS_ENABLED(CONFIG_AVB_PAYLOAD_PACKED)) {
+		fmt->id = AVB_FMT_PACKED;
+		fmt->version = AVB_FMT_PACKED_VERSION;
+		fmt->batch_n = MIN(batch_n, UINT8_MAX);
+
+		/* The encoder fits as many samples as it can in this */
+		fmt->max_size = MIN(CONFIG_AVB_PACKED_PAYLOAD_MAX, room);
+		return fmt->max_size > sizeof(struct compact_hdr) ? 0 : -EINVAL;
+	} else if (IS_ENABLED(CONFIG_AVB_PAYLOAD_ALIGNED)) {
+		fmt->id = AVB_FMT_ALIGNED;
+		fmt->version = AVB_FMT_ALIGNED_VERSION;
+#ifdef CONFIG_AVB_PAYLOAD_ALIGNED
+		align_init(&align, fmt->sensors, ALIGN_PERIOD_NS);
+		align_have_held = false;
+#endif
+	} else if (IS_ENABLED(CONFIG_AVB_PAYLOAD_COMPACT)) {
+		fmt->id = AVB_FMT_COMPACT;
+		fmt->version = AVB_FMT_COMPACT_VERSION;
+	} else if (batch_n > 1) {
+		fmt->id = AVB_FMT_BATCH;
+		fmt->version = 0;
+	} else {
+		fmt->id = AVB_FMT_SENSOR_SET;
+		fmt->version = 0;
+		fmt->batch_n = 1;
+		fmt->max_size = sizeof(struct sensor_set);
+		return room >= (int)fmt->max_size ? 0 : -EINVAL;
+	}
+
+	room -= header_size(fmt);
+	if (room <= 0)
+		return -EINVAL;
+
+	/* n_gyro/n_accel are 8 bit counters */
+	int max_n = MIN(room / (int)record_size(fmt), UINT8_MAX);
+	fmt->batch_n = MIN(batch_n, max_n);
+	fmt->max_size = header_size(fmt) + fmt->batch_n * record_size(fmt);
+
+	return fmt->batch_n > 0 ? 0 : -EINVAL;
+}
+
+size_t payload_max_size(const struct payload_fmt *fmt)
+{
+	return fmt->max_size;
+}
+
+uint32_t payload_format_specific(const struct payload_fmt *fmt)
+{
+	return ((uint32_t)fmt->id << AVB_FMT_SHIFT_ID) |
+		((uint32_t)fmt->version << AVB_FMT_SHIFT_VERSION);
+}
+
+/* Samples are stored in the wire representation of the batch format */
+BUILD_ASSERT(sizeof(struct gyro_sample) == sizeof(struct gyro_set) &&
+	offsetof(struct gyro_sample, ts) == offsetof(struct gyro_set, ts_ns));
+BUILD_ASSERT(sizeof(struct accel_sample) == sizeof(struct accel_set) &&
+	offsetof(struct accel_sample, ts) == offsetof(struct accel_set, ts_ns));
+
+static int build_single(const struct payload_fmt *fmt, struct avb_sensor_data *data, uint8_t *buf)
+{
+	/*
+	 * Drain every sample the collectors have queued since the last
+	 * frame.
+	 *
+	 * The sensor_set payload only has room for a single reading per
+	 * sensor, so the newest one is sent and older ones are coalesced
+	 * into it. If a sensor underproduced (nothing queued), the latest
+	 * published value is repeated and the receiver will see an
+	 * unchanged timestamp.
+	 *
+	 * A sensor not carried by this stream is left zeroed, with a
+	 * 0 timestamp.
+	 */
+	struct gyro_sample gs = {0};
+	struct accel_sample as = {0};
+	int n_gyro = 0;
+	int n_accel = 0;
+
+	if (fmt->sensors & AVB_SENSOR_GYRO) {
+		while (data_drain_gyro(data, &gs) == 0)
+			n_gyro++;
+		if (!n_gyro)
+			data_snapshot_gyro(data, &gs);
+	}
+
+	if (fmt->sensors & AVB_SENSOR_ACCEL) {
+		while (data_drain_accel(data, &as) == 0)
+			n_accel++;
+		if (!n_accel)
+			data_snapshot_accel(data, &as);
+	}
+
+	struct sensor_set *set = (struct sensor_set *)buf;
+	/* all values are already in micro-units */
+	memcpy(set->magn, as.magn, sizeof(set->magn));
+	memcpy(set->gyro, gs.gyro, sizeof(set->gyro));
+	memcpy(set->accel, as.accel, sizeof(set->accel));
+	set->temp = as.temp;
+
+	/* Copy capture timestamps */
+	set->gyro_ts_ns = gs.ts;
+	set->accel_ts_ns = as.ts;
+
+	return sizeof(*set);
+}
+
+static int build_batch(const struct payload_fmt *fmt, struct avb_sensor_data *data, uint8_t *buf)
+{
+	struct sensor_batch_hdr *hdr = (struct sensor_batch_hdr *)buf;
+	uint8_t *pos = buf + sizeof(*hdr);
+	struct gyro_sample gs;
+	struct accel_sample as;
+	int batch_g = fmt->sensors & AVB_SENSOR_GYRO ? fmt->batch_n : 0;
+	int batch_a = fmt->sensors & AVB_SENSOR_ACCEL ? fmt->batch_n : 0;
+	int n;
+
+	/* Straight from the ring into the PDU, no staging buffer */
+	for (n = 0; n < batch_g && data_drain_gyro(data, &gs) == 0; n++) {
+		memcpy(pos, &gs, sizeof(struct gyro_set));
+		pos += sizeof(struct gyro_set);
+	}
+	hdr->n_gyro = n;
+
+	for (n = 0; n < batch_a && data_drain_accel(data, &as) == 0; n++) {
+		memcpy(pos, &as, sizeof(struct accel_set));
+		pos += sizeof(struct accel_set);
+	}
+	hdr->n_accel = n;
+	hdr->reserved = 0;
+	hdr->sent_ts_ns = 0;
+
+	/* No header-only frames */
+	if (!hdr->n_gyro && !hdr->n_accel)
+		return 0;
+	return pos - buf;
+}
+
+/* Round to nearest count of scale_nano and saturate to int16 */
+static int16_t to_count(int64_t micro, int32_t scale_nano)
+{
+	int64_t nano = micro * 1000;
+	int64_t half = nano >= 0 ? scale_nano / 2 : -(scale_nano / 2);
+
+	return (int16_t)CLAMP((nano + half) / scale_nano, INT16_MIN, INT16_MAX);
+}
+
+static uint32_t ts_offset(uint64_t ts, uint64_t base)
+{
+	if (ts <= base)
+		return 0;
+	return (uint32_t)MIN(ts - base, (uint64_t)UINT32_MAX);
+}
+
+static void gyro_to_compact(const struct gyro_sample *gs, uint64_t base,
+			struct compact_gyro *rec)
+{
+	rec->ts_off_ns = sys_cpu_to_le32(ts_offset(gs->ts, base));
+	for (int i = 0; i < 3; i++)
+		rec->gyro[i] = sys_cpu_to_le16(to_count(gs->gyro[i], COMPACT_SCALE_GYRO));
+}
+
+static void accel_to_compact(const struct accel_sample *as, uint64_t base,
+			struct compact_accel *rec)
+{
+	rec->ts_off_ns = sys_cpu_to_le32(ts_offset(as->ts, base));
+	for (int i = 0; i < 3; i++) {
+		rec->accel[i] = sys_cpu_to_le16(to_count(as->accel[i], COMPACT_SCALE_ACCEL));
+		rec->magn[i]  = sys_cpu_to_le16(to_count(as->magn[i], COMPACT_SCALE_MAGN));
+	}
+	rec->temp = sys_cpu_to_le16(to_count(as->temp, COMPACT_SCALE_TEMP));
+}
+
+static void compact_hdr_fill(struct compact_hdr *hdr, uint64_t base)
+{
+	hdr->reserved = 0;
+	hdr->base_ts_ns = sys_cpu_to_le64(base);
+	hdr->sent_ts_off_ns = 0;
+	hdr->scale_gyro = sys_cpu_to_le32(COMPACT_SCALE_GYRO);
+	hdr->scale_accel = sys_cpu_to_le32(COMPACT_SCALE_ACCEL);
+	hdr->scale_magn = sys_cpu_to_le32(COMPACT_SCALE_MAGN);
+	hdr->scale_temp = sys_cpu_to_le32(COMPACT_SCALE_TEMP);
+}
+
+static int build_compact(const struct payload_fmt *fmt, struct avb_sensor_data *data, uint8_t *buf)
+{
+	struct compact_hdr *hdr = (struct compact_hdr *)buf;
+	uint8_t *pos = buf + sizeof(*hdr);
+	struct gyro_sample gs;
+	struct accel_sample as;
+	uint64_t base = 0;
+	int n;
+
+	/* Rings are in capture order, so the oldest sample in the frame
+	 * is the first one of either sensor.
+	 */
+	int batch_n = fmt->batch_n;
+	bool have_g = (fmt->sensors & AVB_SENSOR_GYRO) && data_drain_gyro(data, &gs) == 0;
+	bool have_a = (fmt->sensors & AVB_SENSOR_ACCEL) && data_drain_accel(data, &as) == 0;
+
+	if (!have_g && !have_a)
+		return 0;
+	if (have_g)
+		base = gs.ts;
+	if (have_a && (!have_g || as.ts < base))
+		base = as.ts;
+
+	for (n = 0; have_g; ) {
+		gyro_to_compact(&gs, base, (struct compact_gyro *)pos);
+		pos += sizeof(struct compact_gyro);
+		if (++n == batch_n)
+			break;
+		have_g = data_drain_gyro(data, &gs) == 0;
+	}
+	hdr->n_gyro = n;
+
+	for (n = 0; have_a; ) {
+		accel_to_compact(&as, base, (struct compact_accel *)pos);
+		pos += sizeof(struct compact_accel);
+		if (++n == batch_n)
+			break;
+		have_a = data_drain_accel(data, &as) == 0;
+	}
+	hdr->n_accel = n;
+	compact_hdr_fill(hdr, base);
+
+	return pos - buf;
+}
+
+#ifdef CONFIG_AVB_PAYLOAD_ALIGNED
+/* The record is the sample without its timestamp */
+BUILD_ASSERT(offsetof(struct aligned_sample, ts) == sizeof(struct aligned_set));
+
+static bool aligned_next(struct avb_sensor_data *data, struct aligned_sample *s)
+{
+	if (align_have_held) {
+		*s = align_held;
+		align_have_held = false;
+		return true;
+	}
+	return align_next(&align, data, s);
+}
+
+static int build_aligned(const struct payload_fmt *fmt, struct avb_sensor_data *data, uint8_t *buf)
+{
+	struct aligned_hdr *hdr = (struct aligned_hdr *)buf;
+	uint8_t *pos = buf + sizeof(*hdr);
+	struct aligned_sample s;
+	uint64_t base = 0;
+	int n;
+
+	for (n = 0; n < fmt->batch_n && aligned_next(data, &s); n++) {
+		if (n == 0) {
+			base = s.ts;
+		} else if (s.ts != base + (uint64_t)n * ALIGN_PERIOD_NS) {
+			/* Grid points were skipped, timestamps are implicit */
+			align_held = s;
+			align_have_held = true;
+			break;
+		}
+		memcpy(pos, &s, sizeof(struct aligned_set));
+		pos += sizeof(struct aligned_set);
+	}
+	if (n == 0)
+		return 0;
+
+	hdr->n = n;
+	hdr->reserved = 0;
+	hdr->reserved2 = 0;
+	hdr->period_ns = ALIGN_PERIOD_NS;
+	hdr->base_ts_ns = base;
+	hdr->sent_ts_ns = 0;
+
+	return pos - buf;
+}
+#endif /* CONFIG_AVB_PAYLOAD_ALIGNED */
+
+#ifdef CONFIG_AVB_FUSION
+static int build_quat(const struct payload_fmt *fmt, struct avb_sensor_data *data, uint8_t *buf)
+{
+	struct quat_hdr *hdr = (struct quat_hdr *)buf;
+	struct quat_set *rec = (struct quat_set *)(hdr + 1);
+	struct quat_sample qs;
+	uint64_t base = 0;
+	int n;
+
+	for (n = 0; n < fmt->batch_n && data_drain_quat(data, &qs) == 0; n++, rec++) {
+		if (n == 0)
+			base = qs.ts;
+		rec->ts_off_ns = sys_cpu_to_le32(ts_offset(qs.ts, base));
+		for (int i = 0; i < 4; i++)
+			rec->q[i] = sys_cpu_to_le16(qs.q[i]);
+	}
+	if (n == 0)
+		return 0;
+
+	hdr->n = n;
+	hdr->reserved = 0;
+	hdr->reserved2 = 0;
+	hdr->base_ts_ns = sys_cpu_to_le64(base);
+	hdr->sent_ts_off_ns = 0;
+
+	return (uint8_t *)rec - buf;
+}
+#endif /* CONFIG_AVB_FUSION */
+
+#ifdef CONFIG_AVB_PAYLOAD_PACKED
+/*
+ * Samples drained from the rings but not yet sent.
+ *
+ * The codec needs the whole block up front to pick bit widths, and
+ * samples that did not fit in the previous frame are carried over.
+ */
+static struct {
+	int n;
+	uint64_t ts[CONFIG_AVB_BATCH_SIZE];
+	uint32_t ts_off[CONFIG_AVB_BATCH_SIZE];
+	int16_t val[CONFIG_AVB_BATCH_SIZE][PACKED_GYRO_CH];
+} gyro_stage;
+
+static struct {
+	int n;
+	uint64_t ts[CONFIG_AVB_BATCH_SIZE];
+	uint32_t ts_off[CONFIG_AVB_BATCH_SIZE];
+	int16_t val[CONFIG_AVB_BATCH_SIZE][PACKED_ACCEL_CH];
+} accel_stage;
+
+static void stage_fill(const struct payload_fmt *fmt, struct avb_sensor_data *data)
+{
+	struct gyro_sample gs;
+	struct accel_sample as;
+	int batch_g = fmt->sensors & AVB_SENSOR_GYRO ? fmt->batch_n : 0;
+	int batch_a = fmt->sensors & AVB_SENSOR_ACCEL ? fmt->batch_n : 0;
+
+	while (gyro_stage.n < batch_g && data_drain_gyro(data, &gs) == 0) {
+		int16_t *v = gyro_stage.val[gyro_stage.n];
+
+		for (int i = 0; i < 3; i++)
+			v[i] = to_count(gs.gyro[i], COMPACT_SCALE_GYRO);
+		gyro_stage.ts[gyro_stage.n++] = gs.ts;
+	}
+
+	while (accel_stage.n < batch_a && data_drain_accel(data, &as) == 0) {
+		int16_t *v = accel_stage.val[accel_stage.n];
+
+		for (int i = 0; i < 3; i++) {
+			v[i]     = to_count(as.accel[i], COMPACT_SCALE_ACCEL);
+			v[3 + i] = to_count(as.magn[i], COMPACT_SCALE_MAGN);
+		}
+		v[6] = to_count(as.temp, COMPACT_SCALE_TEMP);
+		accel_stage.ts[accel_stage.n++] = as.ts;
+	}
+}
+
+/* Drop the first n staged samples */
+#define STAGE_CONSUME(stage, cnt)						\
+	do {									\
+		int __left = (stage).n - (cnt);					\
+		memmove((stage).ts, &(stage).ts[cnt], __left * sizeof((stage).ts[0])); \
+		memmove((stage).val, &(stage).val[cnt], __left * sizeof((stage).val[0])); \
+		(stage).n = __left;						\
+	} while (0)
+
+static int build_packed(const struct payload_fmt *fmt, struct avb_sensor_data *data, uint8_t *buf)
+{
+	struct compact_hdr *hdr = (struct compact_hdr *)buf;
+	uint8_t *pos = buf + sizeof(*hdr);
+	size_t room = fmt->max_size - sizeof(*hdr);
+	uint64_t base = 0;
+
+	stage_fill(fmt, data);
+
+	/* With one stream per sensor, each stream only touches its own
+	 * stage.
+	 */
+	int n_g = fmt->sensors & AVB_SENSOR_GYRO ? gyro_stage.n : 0;
+	int n_a = fmt->sensors & AVB_SENSOR_ACCEL ? accel_stage.n : 0;
+
+	if (!n_g && !n_a)
+		return 0;
+	if (n_g)
+		base = gyro_stage.ts[0];
+	if (n_a && (!n_g || accel_stage.ts[0] < base))
+		base = accel_stage.ts[0];
+
+	for (int i = 0; i < n_g; i++)
+		gyro_stage.ts_off[i] = ts_offset(gyro_stage.ts[i], base);
+	for (int i = 0; i < n_a; i++)
+		accel_stage.ts_off[i] = ts_offset(accel_stage.ts[i], base);
+
+	/*
+	 * Shrink the batch until it fits. Halving bounds this to
+	 * log2(batch_n) rounds, and a single sample of each sensor
+	 * always fits.
+	 */
+	size_t sz_g, sz_a;
+
+	for (;;) {
+		sz_g = codec_block_size(gyro_stage.ts_off, &gyro_stage.val[0][0],
+					PACKED_GYRO_CH, n_g);
+		sz_a = codec_block_size(accel_stage.ts_off, &accel_stage.val[0][0],
+					PACKED_ACCEL_CH, n_a);
+		if (sz_g + sz_a <= room || (n_g <= 1 && n_a <= 1))
+			break;
+		n_g = n_g > 1 ? (n_g + 1) / 2 : n_g;
+		n_a = n_a > 1 ? (n_a + 1) / 2 : n_a;
+	}
+
+	int ret = codec_encode_block(pos, room, gyro_stage.ts_off, &gyro_stage.val[0][0],
+				PACKED_GYRO_CH, n_g);
+	if (ret < 0)
+		return ret;
+	pos += ret;
+	room -= ret;
+
+	ret = codec_encode_block(pos, room, accel_stage.ts_off, &accel_stage.val[0][0],
+				PACKED_ACCEL_CH, n_a);
+	if (ret < 0)
+		return ret;
+	pos += ret;
+
+	hdr->n_gyro = n_g;
+	hdr->n_accel = n_a;
+	compact_hdr_fill(hdr, base);
+
+	if (n_g)
+		STAGE_CONSUME(gyro_stage, n_g);
+	if (n_a)
+		STAGE_CONSUME(accel_stage, n_a);
+
+	return pos - buf;
+}
+#endif /* CONFIG_AVB_PAYLOAD_PACKED */
+
+int payload_build(const struct payload_fmt *fmt, struct avb_sensor_data *data, uint8_t *buf)
+{
+	switch (fmt->id) {
+	case AVB_FMT_BATCH:
+		return build_batch(fmt, data, buf);
+	case AVB_FMT_COMPACT:
+		return build_compact(fmt, data, buf);
+#ifdef CONFIG_AVB_PAYLOAD_PACKED
+	case AVB_FMT_PACKED:
+		return build_packed(fmt, data, buf);
+#endif
+#ifdef CONFIG_AVB_PAYLOAD_ALIGNED
+	case AVB_FMT_ALIGNED:
+		return build_aligned(fmt, data, buf);
+#endif
+#ifdef CONFIG_AVB_FUSION
+	case AVB_FMT_QUAT:
+		return build_quat(fmt, data, buf);
+#endif
+	case AVB_FMT_SENSOR_SET:
+		return build_single(fmt, data, buf);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Oldest non-zero of a and b, 0 if neither is set */
+static uint64_t ts_oldest(uint64_t a, uint64_t b)
+{
+	if (!a || !b)
+		return a ? a : b;
+	return MIN(a, b);
+}
+
+uint64_t payload_capture_ts(const struct payload_fmt *fmt, const uint8_t *buf)
+{
+	switch (fmt->id) {
+	case AVB_FMT_BATCH: {
+		const struct sensor_batch_hdr *hdr = (const struct sensor_batch_hdr *)buf;
+		const struct gyro_set *gs = (const struct gyro_set *)(hdr + 1);
+		const struct accel_set *as = (const struct accel_set *)(gs + hdr->n_gyro);
+
+		return ts_oldest(hdr->n_gyro ? gs->ts_ns : 0,
+				hdr->n_accel ? as->ts_ns : 0);
+	}
+	case AVB_FMT_ALIGNED: {
+		const struct aligned_hdr *hdr = (const struct aligned_hdr *)buf;
+
+		return hdr->n ? hdr->base_ts_ns : 0;
+	}
+	case AVB_FMT_QUAT: {
+		const struct quat_hdr *hdr = (const struct quat_hdr *)buf;
+
+		return hdr->n ? sys_le64_to_cpu(hdr->base_ts_ns) : 0;
+	}
+	case AVB_FMT_COMPACT:
+	case AVB_FMT_PACKED: {
+		const struct compact_hdr *hdr = (const struct compact_hdr *)buf;
+
+		if (hdr->n_gyro == 0 && hdr->n_accel == 0)
+			return 0;
+		return sys_le64_to_cpu(hdr->base_ts_ns);
+	}
+	default: {
+		const struct sensor_set *set = (const struct sensor_set *)buf;
+
+		return ts_oldest(set->gyro_ts_ns, set->accel_ts_ns);
+	}
+	}
+}
+
+void payload_set_sent_ts(const struct payload_fmt *fmt, uint8_t *buf, uint64_t ts_ns)
+{
+	switch (fmt->id) {
+	case AVB_FMT_BATCH:
+		((struct sensor_batch_hdr *)buf)->sent_ts_ns = ts_ns;
+		break;
+	case AVB_FMT_ALIGNED:
+		((struct aligned_hdr *)buf)->sent_ts_ns = ts_ns;
+		break;
+	case AVB_FMT_QUAT: {
+		struct quat_hdr *hdr = (struct quat_hdr *)buf;
+
+		if (hdr->n == 0)
+			hdr->base_ts_ns = sys_cpu_to_le64(ts_ns);
+		hdr->sent_ts_off_ns = sys_cpu_to_le32(ts_offset(ts_ns, sys_le64_to_cpu(hdr->base_ts_ns)));
+		break;
+	}
+	case AVB_FMT_COMPACT:
+	case AVB_FMT_PACKED: {
+		struct compact_hdr *hdr = (struct compact_hdr *)buf;
+
+		/* Empty frame, let the send-time be the base */
+		if (hdr->n_gyro == 0 && hdr->n_accel == 0)
+			hdr->base_ts_ns = sys_cpu_to_le64(ts_ns);
+		hdr->sent_ts_off_ns = sys_cpu_to_le32(ts_offset(ts_ns, sys_le64_to_cpu(hdr->base_ts_ns)));
+		break;
+	}
+	default:
+		((struct sensor_set *)buf)->sent_ts_ns = ts_ns;
+		break;
+	}
+}
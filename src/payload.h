@@ -0,0 +1,264 @@
+#pragma once
+#include <stdint.h>
+#include "common.h"
+
+/*
+ * Payload formats
+ *
+ * The format and its version are announced in the format_specific
+ * field of the AVTP stream header (see payload_format_specific()), so
+ * that a listener can dispatch on it without guessing from the length.
+ *
+ *    bits 31..24: format id (enum avb_payload_format)
+ *    bits 23..16: format version
+ *    bits 15..0 : reserved, 0
+ *
+ * AVB_FMT_SENSOR_SET v0 encodes as 0, i.e. what listeners have been
+ * receiving all along.
+ */
+enum avb_payload_format {
+	AVB_FMT_SENSOR_SET = 0,	/* single struct sensor_set */
+	AVB_FMT_BATCH      = 1,	/* struct sensor_batch_hdr + int64 records */
+	AVB_FMT_COMPACT    = 2,	/* struct compact_hdr + fixed-point records */
+	AVB_FMT_PACKED     = 3,	/* struct compact_hdr + codec.h blocks */
+	AVB_FMT_ALIGNED    = 4,	/* struct aligned_hdr + struct aligned_set records */
+	AVB_FMT_QUAT       = 5,	/* struct quat_hdr + struct quat_set records */
+};
+
+#define AVB_FMT_SHIFT_ID		24
+#define AVB_FMT_SHIFT_VERSION		16
+#define AVB_FMT_COMPACT_VERSION		1
+#define AVB_FMT_PACKED_VERSION		1
+#define AVB_FMT_ALIGNED_VERSION		1
+
+/*
+ * Batched sensor payload (AVB_FMT_BATCH)
+ *
+ * Used instead of struct sensor_set when more than one sample per
+ * sensor is sent in each frame (CONFIG_AVB_BATCH_SIZE > 1). All values
+ * are in micro-units and host byte order, same as struct sensor_set.
+ *
+ * Layout on the wire:
+ *
+ *    struct sensor_batch_hdr
+ *    struct gyro_set  [n_gyro]
+ *    struct accel_set [n_accel]
+ *
+ * Samples are in capture order, oldest first.
+ */
+struct sensor_batch_hdr {
+	uint8_t n_gyro;
+	uint8_t n_accel;
+	uint16_t reserved;
+	uint64_t sent_ts_ns;
+} __attribute__((packed));
+
+struct gyro_set {
+	int64_t gyro[3];
+	uint64_t ts_ns;
+} __attribute__((packed));
+
+struct accel_set {
+	int64_t accel[3];
+	int64_t magn[3];
+	int64_t temp;
+	uint64_t ts_ns;
+} __attribute__((packed));
+
+/*
+ * Compact sensor payload (AVB_FMT_COMPACT, version 1)
+ *
+ * Every channel is a signed 16 bit count, value = count * scale where
+ * the scale (in nano-units per LSB) is carried in the header. Sample
+ * timestamps are 32 bit ns offsets from base_ts_ns, which is the
+ * capture time of the oldest sample in the frame. All fields are
+ * little endian.
+ *
+ * Layout on the wire:
+ *
+ *    struct compact_hdr
+ *    struct compact_gyro  [n_gyro]
+ *    struct compact_accel [n_accel]
+ */
+struct compact_hdr {
+	uint8_t n_gyro;
+	uint8_t n_accel;
+	uint16_t reserved;
+	uint64_t base_ts_ns;
+	uint32_t sent_ts_off_ns;
+	int32_t scale_gyro;		/* nrad/s per LSB */
+	int32_t scale_accel;		/* nm/s^2 per LSB */
+	int32_t scale_magn;		/* ngauss per LSB */
+	int32_t scale_temp;		/* n°C per LSB */
+} __attribute__((packed));
+
+struct compact_gyro {
+	uint32_t ts_off_ns;
+	int16_t gyro[3];
+} __attribute__((packed));
+
+struct compact_accel {
+	uint32_t ts_off_ns;
+	int16_t accel[3];
+	int16_t magn[3];
+	int16_t temp;
+} __attribute__((packed));
+
+/* Default channel scales, chosen so that int16 covers the full range of
+ * the sensors without losing resolution:
+ *
+ *  gyro : 0.0625 dps, FXAS21002 LSB at +/-2000 dps
+ *  accel: 0.244 mg, FXOS8700 14 bit LSB at +/-2g, covers +/-8g
+ *  magn : 0.1 uT (1 mgauss), FXOS8700 magnetometer LSB
+ *  temp : 0.01 °C
+ */
+#define COMPACT_SCALE_GYRO		1090831
+#define COMPACT_SCALE_ACCEL		2394202
+#define COMPACT_SCALE_MAGN		1000000
+#define COMPACT_SCALE_TEMP		10000000
+
+/*
+ * Delta/bit-packed sensor payload (AVB_FMT_PACKED, version 1)
+ *
+ * Same header and channel scales as AVB_FMT_COMPACT, but the samples
+ * are compressed with the block codec in codec.h:
+ *
+ *    struct compact_hdr
+ *    codec block, n_gyro samples,  3 channels (gyro x,y,z)
+ *    codec block, n_accel samples, 7 channels (accel x,y,z, magn x,y,z, temp)
+ *
+ * Block timestamps are the same 32 bit offsets from base_ts_ns as in
+ * the compact format.
+ *
+ * Frames are limited to CONFIG_AVB_PACKED_PAYLOAD_MAX bytes (which is
+ * what CBS reserves for), samples that do not compress well enough to
+ * fit are held back for the next frame.
+ */
+#define PACKED_GYRO_CH			3
+#define PACKED_ACCEL_CH			7
+
+/*
+ * Time aligned sensor payload (AVB_FMT_ALIGNED, version 1)
+ *
+ * Gyro and accel/magn/temp interpolated onto a common grid of gPTP
+ * time (see align.h), so each record is a co-timed sample of all
+ * channels. Records are consecutive grid points, record i is at
+ * base_ts_ns + i * period_ns, a gap in the grid starts a new frame.
+ * Values in micro-units and host byte order, like the batch format.
+ *
+ * Layout on the wire:
+ *
+ *    struct aligned_hdr
+ *    struct aligned_set [n]
+ */
+struct aligned_hdr {
+	uint8_t n;
+	uint8_t reserved;
+	uint16_t reserved2;
+	uint32_t period_ns;
+	uint64_t base_ts_ns;
+	uint64_t sent_ts_ns;
+} __attribute__((packed));
+
+struct aligned_set {
+	int64_t gyro[3];
+	int64_t accel[3];
+	int64_t magn[3];
+	int64_t temp;
+} __attribute__((packed));
+
+/*
+ * Orientation payload (AVB_FMT_QUAT)
+ *
+ * Output of the on-node fusion stage (fusion.h), sent by a stream with
+ * AVB_SENSOR_QUAT in place of raw samples. Unit quaternion w, x, y, z
+ * in Q14 (1.0 = 16384), timestamps are 32 bit ns offsets from
+ * base_ts_ns like in the compact format. All fields are little endian.
+ *
+ * Layout on the wire:
+ *
+ *    struct quat_hdr
+ *    struct quat_set [n]
+ */
+struct quat_hdr {
+	uint8_t n;
+	uint8_t reserved;
+	uint16_t reserved2;
+	uint64_t base_ts_ns;
+	uint32_t sent_ts_off_ns;
+} __attribute__((packed));
+
+struct quat_set {
+	uint32_t ts_off_ns;
+	int16_t q[4];
+} __attribute__((packed));
+
+#define QUAT_PAYLOAD_SIZE_BOUND	(sizeof(struct quat_hdr) + \
+		CONFIG_AVB_BATCH_SIZE * sizeof(struct quat_set))
+
+/* Upper bound of payload_max_size() for a stream with gyro (g) and/or
+ * accel (a) samples, before capping to the MTU. A constant expression,
+ * for build time checks.
+ */
+#if defined(CONFIG_AVB_PAYLOAD_PACKED)
+#define PAYLOAD_SIZE_BOUND(g, a)	CONFIG_AVB_PACKED_PAYLOAD_MAX
+#elif defined(CONFIG_AVB_PAYLOAD_ALIGNED)
+#define PAYLOAD_SIZE_BOUND(g, a)	(sizeof(struct aligned_hdr) + \
+		CONFIG_AVB_BATCH_SIZE * sizeof(struct aligned_set))
+#elif defined(CONFIG_AVB_PAYLOAD_COMPACT)
+#define PAYLOAD_SIZE_BOUND(g, a)	(sizeof(struct compact_hdr) + CONFIG_AVB_BATCH_SIZE * \
+		((g) * sizeof(struct compact_gyro) + (a) * sizeof(struct compact_accel)))
+#elif CONFIG_AVB_BATCH_SIZE > 1
+#define PAYLOAD_SIZE_BOUND(g, a)	(sizeof(struct sensor_batch_hdr) + CONFIG_AVB_BATCH_SIZE * \
+		((g) * sizeof(struct gyro_set) + (a) * sizeof(struct accel_set)))
+#else
+#define PAYLOAD_SIZE_BOUND(g, a)	sizeof(struct sensor_set)
+#endif
+
+struct payload_fmt {
+	enum avb_payload_format id;
+	uint8_t version;
+
+	/* enum avb_sensor mask, sensors not in it are left empty */
+	unsigned int sensors;
+
+	/* Max samples per sensor in each frame */
+	int batch_n;
+
+	/* Largest payload in bytes */
+	size_t max_size;
+};
+
+/* Select format from Kconfig (AVB_FMT_QUAT for an AVB_SENSOR_QUAT
+ * stream) and cap batch_n so that a complete PDU
+ * with the selected sensors still fits in max_mtu.
+ *
+ * Returns 0 on success, -EINVAL if not even a single sample fits.
+ */
+int payload_init(struct payload_fmt *fmt, unsigned int sensors, int batch_n, int max_mtu);
+
+/* Largest payload produced with this format */
+size_t payload_max_size(const struct payload_fmt *fmt);
+
+/* Value for the format_specific field in the AVTP stream header */
+uint32_t payload_format_specific(const struct payload_fmt *fmt);
+
+/* Fill buf with sensor data drained from the sample rings.
+ *
+ * For AVB_FMT_SENSOR_SET, the newest sample of each sensor is written.
+ * For AVB_FMT_ALIGNED, up to batch_n grid points are written once both
+ * sensors have covered them. For AVB_FMT_QUAT, up to batch_n queued
+ * orientations. Otherwise up to batch_n samples per sensor
+ * are packed, anything not drained stays queued for the next frame.
+ *
+ * Returns size of payload in bytes, 0 if there was no sample to send.
+ */
+int payload_build(const struct payload_fmt *fmt, struct avb_sensor_data *data, uint8_t *buf);
+
+/* Capture time of the oldest sample in a payload built by
+ * payload_build(), 0 if it carries no samples.
+ */
+uint64_t payload_capture_ts(const struct payload_fmt *fmt, const uint8_t *buf);
+
+/* Stamp the send-time into a payload built by payload_build() */
+void payload_set_sent_ts(const struct payload_fmt *fmt, uint8_t *buf, uint64_t ts_ns);
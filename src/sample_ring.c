@@ -0,0 +1,64 @@
+#include <zephyr/kernel.h>
+#include <zephyr/sys/barrier.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sample_ring.h"
+
+int sample_ring_init(struct sample_ring *r, void *buf, size_t elem_sz, uint32_t num_elems)
+{
+	if (!r || !buf || !elem_sz)
+		return -EINVAL;
+
+	/* Checked at build time for the sizes used */
+	__ASSERT_NO_MSG(IS_POWER_OF_TWO(num_elems));
+
+	atomic_set(&r->head, 0);
+	atomic_set(&r->tail, 0);
+	atomic_set(&r->dropped, 0);
+	r->mask = num_elems - 1;
+	r->elem_sz = elem_sz;
+	r->buf = buf;
+	return 0;
+}
+
+int sample_ring_put(struct sample_ring *r, const void *elem)
+{
+	uint32_t head = (uint32_t)atomic_get(&r->head);
+	uint32_t tail = (uint32_t)atomic_get(&r->tail);
+
+	if (head - tail > r->mask) {
+		atomic_inc(&r->dropped);
+		return -ENOBUFS;
+	}
+
+	memcpy(r->buf + (head & r->mask) * r->elem_sz, elem, r->elem_sz);
+
+	/* element must be visible before the consumer sees the new head */
+	barrier_dmem_fence_full();
+	atomic_set(&r->head, (atomic_val_t)(head + 1));
+	return 0;
+}
+
+int sample_ring_get(struct sample_ring *r, void *elem)
+{
+	uint32_t tail = (uint32_t)atomic_get(&r->tail);
+	uint32_t head = (uint32_t)atomic_get(&r->head);
+
+	if (head == tail)
+		return -EAGAIN;
+
+	barrier_dmem_fence_full();
+	memcpy(elem, r->buf + (tail & r->mask) * r->elem_sz, r->elem_sz);
+
+	/* done reading the slot before handing it back to the producer */
+	barrier_dmem_fence_full();
+	atomic_set(&r->tail, (atomic_val_t)(tail + 1));
+	return 0;
+}
+
+uint32_t sample_ring_count(struct sample_ring *r)
+{
+	return (uint32_t)atomic_get(&r->head) - (uint32_t)atomic_get(&r->tail);
+}
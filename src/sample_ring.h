@@ -0,0 +1,33 @@
+#pragma once
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+/* Lock-free single-producer/single-consumer ring of fixed size elements.
+ *
+ * The producer (a sensor collector) only writes ->head, the consumer
+ * (the network sender) only writes ->tail. Neither side ever blocks; if
+ * the consumer falls behind, new elements are dropped and counted in
+ * ->dropped rather than overwriting elements the consumer may be
+ * reading.
+ *
+ * The number of elements must be a power of 2.
+ */
+struct sample_ring {
+	atomic_t head;
+	atomic_t tail;
+	atomic_t dropped;
+	uint32_t mask;
+	size_t elem_sz;
+	uint8_t *buf;
+};
+
+int sample_ring_init(struct sample_ring *r, void *buf, size_t elem_sz, uint32_t num_elems);
+
+/* Producer side. Returns 0 on success, -ENOBUFS if the ring is full. */
+int sample_ring_put(struct sample_ring *r, const void *elem);
+
+/* Consumer side. Returns 0 on success, -EAGAIN if the ring is empty. */
+int sample_ring_get(struct sample_ring *r, void *elem);
+
+/* Number of elements currently queued (snapshot) */
+uint32_t sample_ring_count(struct sample_ring *r);